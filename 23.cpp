@@ -1,7 +1,37 @@
-/* 
+/*
  * Copyright: Cristobal Leiva and Nicolas Theriault
- * To compile (example for 512 bits): g++ 23.cpp -o 23 -Wall -std=c++11 -O3 -D BITS=512
- * To run: ./23 scalar_in_hexadecimal 
+ * To compile: g++ 23.cpp -o 23 -Wall -std=c++11 -O3 -pthread
+ * Every scalar is solved with the smallest of the widths in CHAIN_WIDTHS (dispatch.h) that holds it, up to 4096 bits.
+ * Adding -D BITS=512 (for example) builds only the 512-bit solvers.
+ * To run: ./23 scalar_in_hexadecimal
+ * Batch mode: ./23 -b [-t threads] [-o table] [file], with one hexadecimal scalar per line of the file (or stdin).
+ * Every output line holds a scalar, the weight of its chain and the terms, in input order.
+ * With -o table, the chains go to the binary file 'table' instead (see chain_file.h for its layout).
+ * -c entries caches up to 'entries' chains, for inputs with repeated scalars; -l table warms the cache from a
+ * table and -s table saves it at the end (see batch.h).
+ * Service mode, a server on a Unix socket answering scalars with chain table records, solved in micro-batches by
+ * solvers kept from one request to the next (see serve.h for the protocol):
+ * ./23 -u [-t threads] [-c entries] [-l table] [-s table] [-d microseconds] [-w bits] socket
+ * -M maps the file (and the table of -o) in memory instead of streaming them, and -r bytes reads the file as
+ * fixed-width records of raw big-endian scalars of 'bytes' bytes each instead of hexadecimal lines. -N reads
+ * decimal lines instead, and writes their scalars in hexadecimal.
+ * Wavefront mode, splitting the DP of one very large scalar over several threads: ./23 -w threads scalar_in_hexadecimal
+ * Banded mode, a near-optimal chain from the cells of the DP near the diagonal where optimal chains go, several times
+ * faster (see banded.h): ./23 -a band scalar_in_hexadecimal, with band 0 for the default one.
+ * Window mode, with digits +-1, +-3, ..., +-(2w-1) for w from 1 to 4: ./23 -d w scalar_in_hexadecimal
+ * Evaluation mode, computing n*P on the reference curve (curve.h) with the chain, with WindowChainSolver chains
+ * for w = 2 to 4 and with NAF and wNAF, and timing each: ./23 -e scalar_in_hexadecimal
+ * Joint mode, the shortest joint chain of two scalars k and l for computing k*P + l*Q with shared doublings and
+ * triplings (see joint.h), compared with one chain per scalar and timed on the reference curve:
+ * ./23 -j k_in_hexadecimal l_in_hexadecimal
+ * 2-3-5 mode, the shortest chain with terms +-2^i*3^j*5^m (see multibase.h), compared with the shortest 2-3 chain,
+ * for scalars of up to 1024 bits: ./23 -5 scalar_in_hexadecimal
+ * Low-memory mode, keeping checkpoints of the DP instead of the whole movements array (see lowmem.h):
+ * ./23 -m scalar_in_hexadecimal, or ./23 -m -b ... for batches.
+ * Starting with -k doubling,tripling,mixed_addition,addition (./23 -k 10,16,11,14 scalar_in_hexadecimal, or with -d)
+ * finds the chain of least cost for those operation costs (see cost_t in dp.h) instead of the shortest one.
+ * Built with -D CHAIN_STATS, a first -S json or -S prometheus (./23 -S json -b ...) writes counters of the DP of
+ * ChainSolver and the time of every phase to stderr at the end (see stats.h).
  * Example for 512 bits: ./23 b518b0217e7f9c3701b8d6bc3d8757c8b961d1b2acb3355ca833c9d5d538b0e0113d44f37feedf5a3cd5617fc979cd1375f60e4c7006b079b67a73b2ea660ab5
  */
 #include <stdint.h>
@@ -10,326 +40,306 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
-#include <bitset>
 #include <chrono>
-#include <iostream>
-#ifndef BITS
-    #define BITS 256
-#endif
+#include <thread>
+#include "banded.h"
+#include "batch.h"
+#include "curve.h"
+#include "dispatch.h"
+#include "exec.h"
+#include "joint.h"
+#include "lowmem.h"
+#include "multibase.h"
+#include "serve.h"
+#include "solver.h"
+#include "stats.h"
+#include "wavefront.h"
+#include "window.h"
 
-static const int64_t max_size = BITS+4;
+static ChainDispatcher<ChainSolver, CHAIN_WIDTHS> solver;
+static ChainDispatcher<LowMemoryChainSolver, CHAIN_WIDTHS> low_memory_solver;
 
-/*
- * Weights of positive (P_weight) and negative (N_weight) chains.
- * We just need two rows of information for previous and current chains.
- * */
-int64_t P_weight[2][max_size], N_weight[2][max_size];
+/* Print the terms of the shortest chain found by the solver */
+template <typename S>
+void print_chain(const S &solver, const chain_t *chain)
+{
+    solver.backtrack(*chain, [](int64_t i, int64_t j, bool negative)
+    {
+        (negative) ? (printf(" - ")): (printf(" + "));
+        printf("2^(%" PRIu64 ")*3^(%" PRIu64 ")", i, j);
+    });
+    printf("\n");
+}
+
+/* Print the terms of a chain with digits, found by WindowChainSolver */
+template <typename S>
+void print_digit_chain(const S &solver, const chain_t *chain)
+{
+    solver.backtrack(*chain, [](int64_t i, int64_t j, int64_t digit)
+    {
+        (digit < 0) ? (printf(" - ")): (printf(" + "));
+        if(digit != 1 && digit != -1)
+            printf("%" PRIu64 "*", (digit < 0) ? -digit: digit);
+        printf("2^(%" PRIu64 ")*3^(%" PRIu64 ")", i, j);
+    });
+    printf("\n");
+}
+
+template <typename S>
+void print_cost(const S &, const chain_t &) {}
+
+template <typename S>
+void print_cost(const S &solver, const chain_t &chain, const cost_t &cost)
+{
+    printf("# Cost of %" PRIu64 "\n", chain_cost(solver, chain, cost));
+}
 
 /*
- * 'Movements array' for storing information for every chain.
- * Every term needs 4 bits of information:
- *      - 1 bit to know whether we did a doubling (0) or tripling (1) to get here (horizontal or vertical step).
- *      - 1 bit to know whether the previous chain was positive (0) or negative (1).
- *      - 2 bits to know if we got here by doing nothing (00), adding a term (01) or substracting a term (11).
- *
- * For example, if we got to some chain by making a vertical step (tripling) from a negative chain and we added
- * a negative term, that means $n_{i,j} = \overline{\mathscr{C}}_{i,j-1} - 2^{i}3^{j-1}$. In this code, this will
- * be denoted as (V, -, -1).
- *
- * int8_t provides 8 bits, so we use the first half of bits for storing information of positive chains
- * and last 4 bits for storing information of negative chains.
- *
- * Example: We zero first half of bits and then store a movement of the type (H, +, -1) which translates to
- * setting bits 0011:
- *
- * T[j][i+1] &= ~(15 << 0);
- * T[j][i+1] |= (3 << 0);
- *
- * Example: We zero second half of bits and then store a movement of the type (V, -, -1) which translates to
- * settings bits 1111:
- *
- * T[j+1][i] &= ~(15 << 4);
- * T[j+1][i] |= (15 << 4);
- *
+ * Solve one scalar, printing the time, the weight and the chain, or given a cost model (cost_t) the chain of
+ * least cost and its cost
  * */
-int8_t T[max_size][max_size];
+template <typename S, typename... A>
+int run_single(S &solver, const char *scalar, void (*print)(const S &, const chain_t *), const A &... cost)
+{
+    chain_t shortest;
 
-typedef struct {
-    int64_t weight;
-    int64_t i;
-    int64_t j;
-} chain_t;
+    auto start = std::chrono::steady_clock::now();
+    int64_t used = solver.solve(scalar, shortest, cost...);
+    auto end = std::chrono::steady_clock::now();
 
-typedef chain_t* chainptr_t;
+    if(used == 0)
+    {
+        fprintf(stderr, "The scalar is too large (or the solver could not be allocated)\n");
+        return 1;
+    }
 
-typedef struct {
-    std::bitset<max_size> num;
-    int64_t msb;
-    bool zero;
-} bigint_t;
+    printf("# Time: %" PRId64 " microseg\n",
+           (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(end-start).count());
 
-typedef bigint_t* bigintptr_t;
+    printf("# Minimum of %" PRIu64 "\n", shortest.weight);
+    print_cost(solver, shortest, cost...);
+    uint64_t clock = stats_clock();
+    print(solver, &shortest);
+    stats_lap(stats_output, clock);
+    return 0;
+}
 
-/* Convert big integers from string hexadecimal representation into a bitset */
-void str_to_bits(char *orig, bigintptr_t dest)
+/* Time 'runs' scalar multiplications by f(result) and check the result against the expected point */
+template <typename F>
+void time_multiply(const char *name, const ReferenceCurve &curve, const jacobian_t &expected, F f)
 {
-    uint8_t digit;
-    uint64_t bitcount = 0;
-    std::bitset<max_size> mask;
-    for(int64_t i = strlen(orig)-1; i >= 0; i--)
+    const int64_t runs = 1000;
+    jacobian_t result;
+    auto start = std::chrono::steady_clock::now();
+    for(int64_t k = 0; k < runs; k++)
+        f(result);
+    auto end = std::chrono::steady_clock::now();
+    printf("# %-10s %10.2f microseg%s\n", name,
+           std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count()/1000.0/runs,
+           (curve.equal(result, expected) && curve.on_curve(result)) ? "": "  WRONG RESULT");
+}
+
+/* Evaluation mode: ./23 -e scalar */
+int eval_main(const char *scalar)
+{
+    ReferenceCurve curve;
+    jacobian_t P, expected;
+    chain_t chain;
+    char name[16];
+    std::vector<int8_t> naf, wnaf;
+    curve.point(P, 2);
+    wnaf_digits(scalar, 2, naf);
+    wnaf_digits(scalar, 4, wnaf);
+    wnaf_multiply(curve, naf, P, 2, expected);
+    if(solver.solve(scalar, chain) == 0)
+    {
+        fprintf(stderr, "The scalar is too large (or the solver could not be allocated)\n");
+        return 1;
+    }
+    /* Only the evaluation is timed, with the digits and the chains computed beforehand */
+    time_multiply("NAF", curve, expected, [&](jacobian_t &r) { wnaf_multiply(curve, naf, P, 2, r); });
+    time_multiply("wNAF w=4", curve, expected, [&](jacobian_t &r) { wnaf_multiply(curve, wnaf, P, 4, r); });
+    ChainExecutor<ReferenceCurve> executor(curve, P);
+    time_multiply("2-3 chain", curve, expected, [&](jacobian_t &r) { executor.multiply(solver, chain, r); });
+    for(int64_t w = 2; w <= WindowChainSolver<64>::max_window; w++)
     {
-        digit = (orig[i] > '9') ? (orig[i] &~ 0x20)-'A'+10: (orig[i]-'0');
-        mask = std::bitset<max_size>(digit);
-        dest->num |= (mask << bitcount);
-        bitcount += 4;
+        ChainDispatcher<WindowChainSolver, CHAIN_WIDTHS> window(w);
+        ChainExecutor<ReferenceCurve> digits(curve, P, w);
+        window.solve(scalar, chain);
+        snprintf(name, sizeof(name), "window w=%" PRIu64, w);
+        time_multiply(name, curve, expected, [&](jacobian_t &r) { digits.multiply(window, chain, r); });
     }
-    dest->zero = (bitcount > 0) ? false: true;
-    dest->msb = bitcount;
+    return 0;
 }
 
-/* Manually divide by 3 by looking at bits and keeping track of carries */
-void divide_by_3(bigintptr_t orig, bigintptr_t dest)
+/* Joint mode: ./23 -j k l */
+int joint_main(const char *k, const char *l)
 {
-    uint8_t carry = 0;
-    orig->zero = true;
-    dest->zero = true;
-    dest->msb = 0;
-    dest->num.reset();
-    for(int64_t i = orig->msb; i >= 0; i--)
+    static JointChainDispatcher<CHAIN_WIDTHS> joint;
+    static ChainDispatcher<ChainSolver, CHAIN_WIDTHS> other;
+    ReferenceCurve curve;
+    jacobian_t P, Q, kP, lQ, expected;
+    chain_t chain, chain_k, chain_l;
+    std::vector<int8_t> naf_k, naf_l;
+
+    auto start = std::chrono::steady_clock::now();
+    int64_t used = joint.solve(k, l, chain);
+    auto end = std::chrono::steady_clock::now();
+
+    if(used == 0 || solver.solve(k, chain_k) == 0 || other.solve(l, chain_l) == 0)
     {
-        if(orig->num.test(i))
-        {
-            if(carry == 1)
-            {
-                dest->num.set(i);
-                carry--;
-                dest->zero = false;
-                if(i > dest->msb) dest->msb = i+1;
-            }
-            else if(carry == 2)
-            {
-                dest->num.set(i);
-                dest->zero = false;
-                if(i > dest->msb) dest->msb = i+1;
-            }
-            else
-                carry++;
-            orig->zero = false;
-        }
+        fprintf(stderr, "The scalars are too large (or the solver could not be allocated)\n");
+        return 1;
+    }
+    printf("# Time: %" PRId64 " microseg\n",
+           (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(end-start).count());
+    printf("# Minimum of %" PRIu64 ", against %" PRIu64 " + %" PRIu64 " with one chain per scalar\n",
+           chain.weight, chain_k.weight, chain_l.weight);
+    joint.backtrack(chain, [](int64_t i, int64_t j, int64_t d, int64_t e)
+    {
+        /* The sign of the first non-zero digit goes in front */
+        int64_t sign = (d != 0) ? d: e;
+        printf((sign < 0) ? " - ": " + ");
+        if(d != 0 && e != 0)
+            printf("(P %c Q)*", (d == e) ? '+': '-');
         else
-        {
-            if(carry == 1)
-                carry++;
-            else if(carry == 2)
-            {
-                dest->num.set(i);
-                carry--;
-                dest->zero = false;
-                if(i > dest->msb) dest->msb = i+1;
-            }
-        }
+            printf("%c*", (d != 0) ? 'P': 'Q');
+        printf("2^(%" PRIu64 ")*3^(%" PRIu64 ")", i, j);
+    });
+    printf("\n");
+
+    curve.point(P, 2);
+    curve.point(Q, 1000);
+    wnaf_digits(k, 2, naf_k);
+    wnaf_digits(l, 2, naf_l);
+    wnaf_multiply(curve, naf_k, P, 2, kP);
+    wnaf_multiply(curve, naf_l, Q, 2, lQ);
+    curve.add(expected, kP, lQ);
+    ChainExecutor<ReferenceCurve> executor_P(curve, P), executor_Q(curve, Q);
+    JointChainExecutor<ReferenceCurve> executor(curve, P, Q);
+    time_multiply("2 chains", curve, expected, [&](jacobian_t &r)
+    {
+        executor_P.multiply(solver, chain_k, kP);
+        executor_Q.multiply(other, chain_l, lQ);
+        curve.add(r, kP, lQ);
+    });
+    time_multiply("joint", curve, expected, [&](jacobian_t &r) { executor.multiply(joint, chain, r); });
+    return 0;
+}
+
+/* 2-3-5 mode: ./23 -5 scalar */
+int multibase_main(const char *scalar)
+{
+    static ChainDispatcher<MultiBaseChainSolver, MULTIBASE_WIDTHS> multibase;
+    chain_t chain, chain_23;
+
+    auto start = std::chrono::steady_clock::now();
+    int64_t used = multibase.solve(scalar, chain);
+    auto end = std::chrono::steady_clock::now();
+
+    if(used == 0 || solver.solve(scalar, chain_23) == 0)
+    {
+        fprintf(stderr, "The scalar is too large (or the solver could not be allocated)\n");
+        return 1;
     }
+    printf("# Time: %" PRId64 " microseg\n",
+           (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(end-start).count());
+    printf("# Minimum of %" PRIu64 ", against %" PRIu64 " with a 2-3 chain\n", chain.weight, chain_23.weight);
+    multibase.backtrack(chain, [](int64_t i, int64_t j, int64_t m, bool negative)
+    {
+        (negative) ? (printf(" - ")): (printf(" + "));
+        printf("2^(%" PRIu64 ")*3^(%" PRIu64 ")*5^(%" PRIu64 ")", i, j, m);
+    });
+    printf("\n");
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    printf("\nUsage: %s [-S json | -S prometheus] [-k costs] hexadecimal_integer\n", name);
+    printf("       %s -b [-t threads] [-o table] [-c entries] [-l table] [-s table] [-M] [-N] [-r bytes] [file]\n", name);
+    printf("       %s -u [-t threads] [-c entries] [-l table] [-s table] [-d microseconds] [-w bits] socket\n", name);
+    printf("       %s -w threads hexadecimal_integer\n", name);
+    printf("       %s -a band hexadecimal_integer\n", name);
+    printf("       %s [-k costs] -d window hexadecimal_integer\n", name);
+    printf("       %s -e hexadecimal_integer\n", name);
+    printf("       %s -j hexadecimal_integer hexadecimal_integer\n", name);
+    printf("       %s -5 hexadecimal_integer\n", name);
+    printf("       %s -m hexadecimal_integer\n", name);
+    printf("       %s -m -b [-t threads] [-o table] [-c entries] [-l table] [-s table] [-M] [-N] [-r bytes] [file]\n\n", name);
+    exit(1);
 }
 
-void optimal_chain(bigint_t a, chainptr_t shortest)
+int main(int argc, char *argv[])
 {
-    bigint_t b ;
-    int64_t i, j, size, cont;
-    int8_t curr, next, aux;
-    /* Initialization */
-    for(i = 0; i < max_size; i++)
-        P_weight[0][i] = N_weight[0][i] = max_size;
-    shortest->weight = max_size;
-    P_weight[0][0] = 0; /* base case */
-    j = 0;
-    curr = 0;
-    next = 1;
-    while(!a.zero)
+    cost_t costs, *cost = NULL;
+    if(argc >= 3 && strcmp(argv[1], "-S") == 0)
     {
-        divide_by_3(&a, &b);
-        cont = 0;
-        size = a.msb;
-        P_weight[next][size+1] = N_weight[next][size+1] = max_size;
-        P_weight[next][size+2] = N_weight[next][size+2] = max_size;
-        for(i = 0; i <= size; i++)
-        {
-            /* We don't need to check all the cases if weights of both positive and negative chains
-             * are equal or greater than the shortest chain found so far */
-            if(P_weight[curr][i] >= shortest->weight && N_weight[curr][i] >= shortest->weight)
-            {
-                P_weight[next][i] = N_weight[next][i] = max_size;
-                cont++;
-            }
-            else
-            {
-                /* Horizontal steps */
-                if(a.num.test(i))
-                {
-                    if(N_weight[curr][i] < N_weight[curr][i+1]) /* (H, -, 0) */
-                    {
-                        N_weight[curr][i+1] = N_weight[curr][i];
-                        T[j][i+1] &= 15;
-                        T[j][i+1] |= 64; /* 0100 */
-                    }
-                    if(P_weight[curr][i]+1 < P_weight[curr][i+1]) /* (H, +, +1) */
-                    {
-                        P_weight[curr][i+1] = P_weight[curr][i]+1;
-                        T[j][i+1] &= 240;
-                        T[j][i+1] |= 1; /* 0001 */
-                    }
-                    if(P_weight[curr][i]+1 < N_weight[curr][i+1]) /* (H, +, -1) */
-                    {
-                        N_weight[curr][i+1] = P_weight[curr][i]+1;
-                        T[j][i+1] &= 15;
-                        T[j][i+1] |= 48; /* 0011 */
-                    }
-                }
-                else /* bit == 0 */
-                {
-                    if(P_weight[curr][i] < P_weight[curr][i+1]) /* (H, +, 0) */
-                    {
-                        P_weight[curr][i+1] = P_weight[curr][i];
-                        T[j][i+1] &= 240;
-                    }
-                    if(N_weight[curr][i]+1 < N_weight[curr][i+1]) /* (H, -, -1) */
-                    {
-                        N_weight[curr][i+1] = N_weight[curr][i]+1;
-                        T[j][i+1] &= 15;
-                        T[j][i+1] |= 112; /* 0111 */
-                    }
-                    if(N_weight[curr][i]+1 < P_weight[curr][i+1]) /* (H, -, +1) */
-                    {
-                        P_weight[curr][i+1] = N_weight[curr][i]+1;
-                        T[j][i+1] &= 240;
-                        T[j][i+1] |= 5; /* 0101 */
-                    }
-                }
-                /* Vertical steps */
-                if(!a.zero)
-                {
-                    if(a.num.test(i) ^ b.num.test(i))
-                    {
-                        P_weight[next][i] = P_weight[curr][i]+1;
-                        N_weight[next][i] = N_weight[curr][i]+1;
-                        T[j+1][i] = 249; /* 1111 and 1001 */
-                    }
-                    else
-                    {
-                        if(a.num.test(i) ^ a.num.test(i+1) ^ b.num.test(i+1))
-                        {
-                            P_weight[next][i] = max_size;
-                            N_weight[next][i] = P_weight[curr][i]+1;
-                            T[j+1][i] = 176; /* 1011 and 0000 */
-                            if(N_weight[curr][i] < N_weight[next][i]) /* (V, -, 0) */
-                            {
-                                N_weight[next][i] = N_weight[curr][i];
-                                T[j+1][i] &= 15;
-                                T[j+1][i] |= 192; /* 1100 */
-                            }
-                        }
-                        else
-                        {
-                            N_weight[next][i] = max_size;
-                            P_weight[next][i] = P_weight[curr][i];
-                            T[j+1][i] = 8; /* 0000 and 1000 */
-                            if(N_weight[curr][i]+1 < P_weight[next][i]) /* (V, -, +1) */
-                            {
-                                P_weight[next][i] = N_weight[curr][i]+1;
-                                T[j+1][i] &= 240;
-                                T[j+1][i] |= 13; /* 1101 */
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        /* Check if this iteration produced a chain shorter than the shortest so far */
-        if(P_weight[curr][size+1] < shortest->weight)
-        {
-            shortest->weight = P_weight[curr][size+1];
-            shortest->i = size+1;
-            shortest->j = j;
-        }
-        if(P_weight[curr][size+2] < shortest->weight)
-        {
-            shortest->weight = P_weight[curr][size+2];
-            shortest->i = size+2;
-            shortest->j = j;
-        }
-        if(a.zero) break;
-        size = b.msb;
-        if(P_weight[next][size+1] < shortest->weight)
+        if(stats_write_at_exit(argv[2]) != 0)
         {
-            shortest->weight = P_weight[next][size+1];
-            shortest->i = size+1;
-            shortest->j = j+1;
+            fprintf(stderr, (stats_enabled) ? "Statistics are written as json or prometheus\n":
+                    "Statistics need a build with -D CHAIN_STATS\n");
+            return 1;
         }
-        if(P_weight[next][size+2] < shortest->weight)
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    if(argc >= 3 && strcmp(argv[1], "-k") == 0)
+    {
+        if(sscanf(argv[2], "%" SCNd64 ",%" SCNd64 ",%" SCNd64 ",%" SCNd64, &costs.doubling, &costs.tripling,
+                  &costs.mixed_addition, &costs.addition) != 4)
         {
-            shortest->weight = P_weight[next][size+2];
-            shortest->i = size+2;
-            shortest->j = j+1;
+            fprintf(stderr, "Costs must be given as doubling,tripling,mixed_addition,addition\n");
+            return 1;
         }
-        if(cont >= a.msb) break;
-        a = b;
-        j++;
-        aux = curr;
-        curr = next;
-        next = aux;
+        cost = &costs;
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
     }
-}
-
-/* Backtrack from the information of the shortest chain and the information array T */
-void print_chain(chainptr_t chain)
-{
-    int64_t i = chain->i;
-    int64_t j = chain->j;
-    int8_t base = 0;
-    bool type = T[j][i] & 8;
-    bool sign = T[j][i] & 4;
-    bool change_sign = T[j][i] & 2;
-    bool change_value = T[j][i] & 1;
-    while(chain->weight > 0)
+    if(argc >= 2 && strcmp(argv[1], "-m") == 0)
     {
-        (type) ? (j--): (i--);
-        if(change_value)
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+        if(cost)
         {
-            (change_sign) ? (printf(" - ")): (printf(" + "));
-            printf("2^(%" PRIu64 ")*3^(%" PRIu64 ")", i, j);
-            chain->weight--;
+            fprintf(stderr, "The low-memory mode only finds shortest chains, without costs\n");
+            return 1;
         }
-        (sign) ? (base = 4): (base = 0);
-        type = T[j][i] & (1 << (base+3));
-        sign = T[j][i] & (1 << (base+2));
-        change_sign = T[j][i] & (1 << (base+1));
-        change_value = T[j][i] & (1 << base);
+        if(argc >= 2 && strcmp(argv[1], "-b") == 0)
+            return batch_main<ChainDispatcher<LowMemoryChainSolver, CHAIN_WIDTHS>>(argc, argv);
+        if(argc == 2)
+            return run_single(low_memory_solver, argv[1], print_chain);
+        usage(argv[0]);
     }
-    printf("\n");
-}
-
-int main(int argc, char *argv[])
-{
-    if(argc != 2)
+    if(argc >= 2 && strcmp(argv[1], "-b") == 0)
+        return batch_main<ChainDispatcher<ChainSolver, CHAIN_WIDTHS>>(argc, argv);
+    if(argc >= 2 && strcmp(argv[1], "-u") == 0)
+        return serve_main<ChainDispatcher<ChainSolver, CHAIN_WIDTHS>>(argc, argv);
+    if(argc == 4 && strcmp(argv[1], "-w") == 0)
     {
-        printf("\nUsage: %s hexadecimal_integer\n\n", argv[0]);
-        exit(1);
+        ChainDispatcher<WavefrontChainSolver, CHAIN_WIDTHS> wavefront(atoi(argv[2]));
+        return run_single(wavefront, argv[3], print_chain);
     }
-    
-    bigint_t n;
-    str_to_bits(argv[1], &n);
-    chain_t shortest;
-    
-    auto start = std::chrono::steady_clock::now();
-    optimal_chain(n, &shortest);
-    auto end = std::chrono::steady_clock::now();
-    
-    std::cout << "# Time: ";
-    std::cout << (std::chrono::duration_cast<std::chrono::microseconds>(end-start).count()) << std::endl;
-    std::cout << " microseg" << std::endl;
-    
-    printf("# Minimum of %" PRIu64 "\n", shortest.weight);
-    print_chain(&shortest);
-    
-    return 0;
+    if(argc == 4 && strcmp(argv[1], "-a") == 0)
+    {
+        ChainDispatcher<BandedChainSolver, CHAIN_WIDTHS> banded(atoi(argv[2]));
+        return run_single(banded, argv[3], print_chain);
+    }
+    if(argc == 3 && strcmp(argv[1], "-e") == 0)
+        return eval_main(argv[2]);
+    if(argc == 4 && strcmp(argv[1], "-j") == 0)
+        return joint_main(argv[2], argv[3]);
+    if(argc == 3 && strcmp(argv[1], "-5") == 0)
+        return multibase_main(argv[2]);
+    if(argc == 4 && strcmp(argv[1], "-d") == 0)
+    {
+        ChainDispatcher<WindowChainSolver, CHAIN_WIDTHS> window(atoi(argv[2]));
+        return (cost) ? run_single(window, argv[3], print_digit_chain, *cost): run_single(window, argv[3], print_digit_chain);
+    }
+    if(argc != 2)
+        usage(argv[0]);
+    return (cost) ? run_single(solver, argv[1], print_chain, *cost): run_single(solver, argv[1], print_chain);
 }
-
@@ -0,0 +1,136 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Near-optimal 2-3 chains from the DP of ChainSolver restricted to a band of cells around the diagonal where
+ * optimal chains go, for when a chain is needed fast and a few more terms are acceptable.
+ */
+#ifndef BANDED_H
+#define BANDED_H
+
+#include <stdint.h>
+#include <algorithm>
+#include "dp.h"
+#include "solver.h"
+
+/*
+ * Optimal chains of random scalars end near the cell (2j, j) of their row, with j about 0.28 times the bit length
+ * at every width, and their paths stay near the line i = 2j on the way. Row j only processes the cells within
+ * 'band' of that line, i from 2j-band to 2j+band, and once the line is past the end of the row (2j >= msb), the
+ * last band+1 cells of the row, msb-band to msb, as the window is centered on the end of the row then. Every other
+ * cell is unreachable, so the chain found is a chain of the DP, valid but perhaps not the shortest, and the work
+ * goes from O(width^2) cells to O(width*band).
+ *
+ * The windows of two consecutive rows overlap, since they move right by two cells per row, and they reach the end
+ * of the rows, so there is always a chain. With band >= width every cell is processed and the chains are those of
+ * ChainSolver. The paths of optimal chains stray from the line by about the square root of the width, and the
+ * default band, 4*sqrt(width), finds chains within 1% of the shortest (see the last table of bench.cpp).
+ * */
+template <int64_t width>
+class BandedChainSolver
+{
+public:
+    typedef bigint_t<width> scalar_t;
+
+    static const int64_t default_band = 4*ceil_sqrt(width);
+
+    /* A band of 0 (or less) is the default one */
+    explicit BandedChainSolver(int64_t band = 0) : band((band < 1) ? default_band: band) {}
+
+    void solve(const scalar_t &a, chain_t &shortest);
+
+    /* Call term(i, j, negative) for every term of a chain found by the last call to solve() */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const
+    {
+        walk_chain(T, &chain, term);
+    }
+
+private:
+    static const int64_t max_size = dp_size<width>::max_size;
+    static const int64_t max_rows = dp_size<width>::max_rows;
+    static const int64_t max_cells = dp_size<width>::max_cells;
+
+    int64_t band;
+
+    /* Weights of two rows, movements array and plane as in ChainSolver */
+    weight_row_t<width> weights[2];
+    int8_t T_cells[max_cells];
+    int8_t *T[max_rows];
+    plane_t<width> plane;
+
+    /* First and last cell of the window of row j */
+    void window(int64_t j, int64_t &first, int64_t &last) const
+    {
+        int64_t center = std::min(2*j, plane.msb[j]);
+        first = std::max((int64_t)0, center-band);
+        last = std::min(plane.msb[j], center+band);
+    }
+};
+
+/*
+ * Before row j is processed, the window of row j+1 and the two cells after it start unreachable, and the vertical
+ * steps from the window of row j overwrite the cells where both windows overlap. Cells of row j from its window on
+ * have been set this way, so the horizontal steps into the cell after the window, and the ends of the row when
+ * the window reaches them, read weights of this scalar.
+ * */
+template <int64_t width>
+void BandedChainSolver<width>::solve(const scalar_t &a, chain_t &shortest)
+{
+    int64_t i, j, size, first, last, next_first, next_last, cont;
+    int8_t curr = 0, next = 1;
+    fill_plane(&a, &plane, divide_by_3<width>);
+    layout_rows(&plane, T_cells, T);
+    /* Zero has the empty chain */
+    shortest.weight = (a.zero) ? 0: max_size;
+    shortest.i = shortest.j = 0;
+    window(0, first, last);
+    for(i = first; i <= last+2; i++)
+        weights[0].P[i] = weights[0].N[i] = max_size;
+    weights[0].P[0] = 0; /* base case */
+    for(j = 0; j < plane.rows; j++)
+    {
+        const uint64_t *bits = plane.bits[j], *vert = plane.vert[j], *vert_carry = plane.vert_carry[j];
+        size = plane.msb[j];
+        window(j, first, last);
+        window(j+1, next_first, next_last);
+        for(i = next_first; i <= next_last+2; i++)
+            weights[next].P[i] = weights[next].N[i] = max_size;
+        cont = 0;
+        for(i = first; i <= last; i++)
+        {
+            if(weights[curr].P[i] >= shortest.weight && weights[curr].N[i] >= shortest.weight)
+            {
+                weights[next].P[i] = weights[next].N[i] = max_size;
+                cont++;
+            }
+            else
+            {
+                horizontal_steps(get_bit(bits, i), weights[curr].P[i], weights[curr].N[i],
+                                 weights[curr].P[i+1], weights[curr].N[i+1], T[j][i+1]);
+                vertical_steps(get_bit(vert, i), get_bit(vert_carry, i), weights[curr].P[i], weights[curr].N[i],
+                               weights[next].P[i], weights[next].N[i], T[j+1][i], max_size);
+            }
+        }
+        /* Ends of the rows, when the windows reach them */
+        for(i = size+1; last == size && i <= size+2; i++)
+            if(weights[curr].P[i] < shortest.weight)
+            {
+                shortest.weight = weights[curr].P[i];
+                shortest.i = i;
+                shortest.j = j;
+            }
+        size = plane.msb[j+1];
+        for(i = size+1; next_last == size && i <= size+2; i++)
+            if(weights[next].P[i] < shortest.weight)
+            {
+                shortest.weight = weights[next].P[i];
+                shortest.i = i;
+                shortest.j = j+1;
+            }
+        /* Every cell of the window is pruned, so nothing reaches the next rows */
+        if(cont > last-first)
+            break;
+        std::swap(curr, next);
+    }
+}
+
+#endif
@@ -0,0 +1,578 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Batch mode: optimal chains for a stream of scalars, one dispatcher (dispatch.h) per worker thread.
+ */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cache.h"
+#include "chain_file.h"
+#include "dispatch.h"
+#include "stats.h"
+
+/* Number of scalars read, solved and written together */
+static const int64_t batch_block = 4096;
+
+/* Append the decimal digits of v, which for millions of terms is much cheaper than snprintf */
+static inline void append_decimal(std::string &out, uint64_t v)
+{
+    char digits[20];
+    int k = 20;
+    do
+    {
+        digits[--k] = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    out.append(digits+k, 20-k);
+}
+
+/* Buffers of one worker, kept from one scalar to the next so that solving a block does not allocate */
+typedef struct {
+    std::string scalar;
+    std::vector<uint32_t> terms;
+} batch_scratch_t;
+
+/* Words of a scalar (append_scalar(), chain_file.h), which key the cache and go in its record */
+static inline void batch_scalar_words(std::string &out, const scalar_ref_t &scalar)
+{
+    out.clear();
+    if(scalar.raw)
+        append_scalar(out, scalar.raw, scalar.bytes);
+    else
+        append_scalar(out, scalar.hex);
+}
+
+/*
+ * Format the chain of a scalar, whose words (from batch_scalar_words()) and terms are in 'scratch', as
+ * "scalar weight terms", or "scalar -1" when it was not solved, with raw scalars in two hexadecimal digits per
+ * byte. With 'binary', the result is the record of the scalar in a chain table instead (see chain_file.h).
+ * */
+static inline void batch_format(const scalar_ref_t &scalar, const batch_scratch_t &scratch, bool solved,
+                                std::string &result, bool binary)
+{
+    term_t term;
+    int64_t k;
+    result.clear();
+    if(binary)
+    {
+        append_record(result, scratch.scalar, (solved) ? scratch.terms.size(): chain_unsolved, scratch.terms.data());
+        return;
+    }
+    if(scalar.raw)
+        for(k = 0; k < scalar.bytes; k++)
+        {
+            result += "0123456789abcdef"[scalar.raw[k] >> 4];
+            result += "0123456789abcdef"[scalar.raw[k] & 15];
+        }
+    else
+        result = scalar.hex;
+    if(!solved)
+    {
+        result += " -1\n";
+        return;
+    }
+    result += ' ';
+    append_decimal(result, scratch.terms.size());
+    for(uint32_t packed : scratch.terms)
+    {
+        term = unpack_term(packed);
+        result += (term.negative) ? " - 2^(": " + 2^(";
+        append_decimal(result, term.i);
+        result += ")*3^(";
+        append_decimal(result, term.j);
+        result += ')';
+    }
+    result += '\n';
+}
+
+/*
+ * Solve one scalar with a dispatcher (dispatch.h), or find it in the cache, and format it with batch_format().
+ * It is unsolved when it is larger than every width of the dispatcher.
+ * */
+template <typename S>
+static void batch_solve(S *solver, ChainCache *cache, const scalar_ref_t &scalar_in, std::string &result,
+                        bool binary, batch_scratch_t &scratch)
+{
+    chain_t chain;
+    std::string &scalar = scratch.scalar;
+    std::vector<uint32_t> &terms = scratch.terms;
+    bool solved = true;
+    uint64_t clock = stats_clock();
+    batch_scalar_words(scalar, scalar_in);
+    if(cache == NULL || !cache->lookup(scalar, terms))
+    {
+        solved = solver->solve(scalar_in, chain) != 0;
+        clock = stats_clock();
+        if(solved)
+        {
+            terms.resize(chain.weight);
+            chain_packed_terms(*solver, chain, terms.data());
+            if(cache)
+                cache->insert(scalar, terms.data(), terms.size());
+        }
+    }
+    batch_format(scalar_in, scratch, solved, result, binary);
+    stats_lap(stats_output, clock);
+}
+
+/*
+ * Number of scalars a worker takes at a time. Dispatchers that solve several scalars together (LaneDispatcher,
+ * lanes.h) overload it and batch_solve_group().
+ * */
+template <typename S>
+static inline int64_t batch_group(const S *)
+{
+    return 1;
+}
+
+/* Solve the scalars scalars[index[0]] to scalars[index[count-1]] into the same entries of 'results' */
+template <typename S>
+static void batch_solve_group(S *solver, ChainCache *cache, const std::vector<scalar_ref_t> &scalars,
+                              std::vector<std::string> &results, const int64_t *index, int64_t count, bool binary,
+                              batch_scratch_t &scratch)
+{
+    for(int64_t k = 0; k < count; k++)
+        batch_solve(solver, cache, scalars[index[k]], results[index[k]], binary, scratch);
+}
+
+/*
+ * Order in which the scalars of a block are handed out: input order, or for groups of more than one scalar
+ * by length, so that the scalars of a group have rows of about the same lengths
+ * */
+static inline void batch_order(const std::vector<scalar_ref_t> &scalars, int64_t count, int64_t group,
+                               std::vector<int64_t> &order)
+{
+    order.resize(count);
+    for(int64_t k = 0; k < count; k++)
+        order[k] = k;
+    if(group > 1)
+        std::stable_sort(order.begin(), order.end(), [&](int64_t a, int64_t b)
+        {
+            return scalar_bits(scalars[a]) < scalar_bits(scalars[b]);
+        });
+}
+
+/*
+ * Source of the scalars of a batch: a stream of lines, or a file mapped in memory (batch_map_input()) holding
+ * lines or, with record_bytes > 0, fixed-width records of raw big-endian scalars of that many bytes each.
+ * With 'decimal', lines hold decimal scalars instead of hexadecimal ones.
+ * */
+typedef struct {
+    FILE *stream;
+    const char *data;
+    uint64_t size;
+    uint64_t pos;
+    int64_t record_bytes;
+    bool decimal;
+} batch_input_t;
+
+/* Map the file at 'path' for reading from start to end. Returns 0, or -1 if it cannot be mapped */
+static inline int batch_map_input(const char *path, int64_t record_bytes, batch_input_t &in)
+{
+    struct stat st;
+    void *data = NULL;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) != 0 ||
+       (st.st_size > 0 && (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+    {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    if(data)
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+    in.stream = NULL;
+    in.data = (const char *)data;
+    in.size = st.st_size;
+    in.pos = 0;
+    in.record_bytes = record_bytes;
+    return 0;
+}
+
+static inline void batch_close_input(batch_input_t &in)
+{
+    if(in.stream && in.stream != stdin)
+        fclose(in.stream);
+    if(in.data)
+        munmap((void *)in.data, in.size);
+}
+
+/*
+ * Largest chain table the scalars of a mapped input can give, header and index included. The record of a line of
+ * L digits has 2 words, ceil(L/8) words of scalar and at most 2L+2 terms, and its index entry 2 more words, so at
+ * most 2L + (L+7)/8 + 6 words. Summed over the lines, with the L at most the size of the file and at most
+ * (size+1)/2 lines (a digit and a newline each), that is the bound below: even a file of 1-digit lines fits.
+ * A record of B bytes has at most 4B+2 terms and 5B+7 words.
+ * */
+static inline uint64_t batch_table_bound(const batch_input_t &in)
+{
+    uint64_t records = (in.record_bytes > 0) ? in.size/in.record_bytes: 0, lines = (in.size+1)/2;
+    return sizeof(chain_file_header_t) + 8 +
+           ((in.record_bytes > 0) ? records*4*(5*in.record_bytes+7): 4*(2*in.size + (in.size+7*lines)/8 + 6*lines));
+}
+
+/* Whitespace at the end of a line */
+static inline bool batch_space(char c)
+{
+    return c == '\n' || c == '\r' || c == ' ' || c == '\t';
+}
+
+/* Largest decimal scalars converted by batch_decimal(): more bits than every width, and 10^2466 < 2^8192 */
+static const int64_t batch_decimal_bits = 8192, batch_decimal_digits = 2466;
+
+/*
+ * Replace a line of decimal digits by the same scalar in hexadecimal. A scalar of more than batch_decimal_digits
+ * digits is left as it is, which as a hexadecimal scalar is still larger than every width and so unsolved.
+ * */
+static inline void batch_decimal(std::string &line, bigint_t<batch_decimal_bits> &n)
+{
+    size_t start = line.find_first_not_of('0');
+    int64_t k;
+    if(start == std::string::npos)
+    {
+        line = "0";
+        return;
+    }
+    if((int64_t)(line.size()-start) > batch_decimal_digits)
+        return;
+    dec_to_bits(line.c_str()+start, &n);
+    line.clear();
+    for(k = (n.msb+3)/4 - 1; k >= 0; k--)
+        line += "0123456789abcdef"[(n.num[k >> 4] >> (4*(k & 15))) & 15];
+}
+
+/*
+ * Read up to scalars.size() scalars, one per line into 'lines', skipping blank lines and lines starting with '#'.
+ * Decimal lines are turned into hexadecimal ones as they are read.
+ * Records of raw scalars are not copied: their entries of 'scalars' point into the mapping, and solvers parse
+ * them from there.
+ * */
+static int64_t batch_read(batch_input_t &in, std::vector<std::string> &lines, std::vector<scalar_ref_t> &scalars)
+{
+    const char *line, *stop;
+    char *buf = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int64_t count = 0, k;
+    bigint_t<batch_decimal_bits> decimal;
+    if(in.stream)
+    {
+        while(count < (int64_t)scalars.size() && (len = getline(&buf, &cap, in.stream)) >= 0)
+        {
+            while(len > 0 && batch_space(buf[len-1]))
+                buf[--len] = 0;
+            if(len == 0 || buf[0] == '#')
+                continue;
+            lines[count++].assign(buf, len);
+        }
+        free(buf);
+    }
+    else if(in.record_bytes > 0)
+    {
+        /* A partial record at the end of the file is ignored */
+        for(; count < (int64_t)scalars.size() && in.size - in.pos >= (uint64_t)in.record_bytes;
+            in.pos += in.record_bytes)
+            scalars[count++] = raw_scalar((const uint8_t *)in.data + in.pos, in.record_bytes);
+        return count;
+    }
+    while(!in.stream && count < (int64_t)scalars.size() && in.pos < in.size)
+    {
+        line = in.data + in.pos;
+        stop = (const char *)memchr(line, '\n', in.size - in.pos);
+        len = (stop) ? stop-line: (ssize_t)(in.size - in.pos);
+        in.pos += len+1;
+        while(len > 0 && batch_space(line[len-1]))
+            len--;
+        if(len == 0 || line[0] == '#')
+            continue;
+        lines[count++].assign(line, len);
+    }
+    for(k = 0; k < count; k++)
+    {
+        if(in.decimal)
+            batch_decimal(lines[k], decimal);
+        scalars[k] = hex_scalar(lines[k].c_str());
+    }
+    return count;
+}
+
+/* Destination of the results: a stream, or a chain table written through a mapping when 'table' is set */
+typedef struct {
+    FILE *stream;
+    mapped_table_t *table;
+} batch_output_t;
+
+/*
+ * Solve every scalar of 'in' with 'threads' workers and write one line per scalar to 'out', in input order,
+ * or with 'binary' a chain table (chain_file.h), for which a stream must be seekable. A mapped table is always
+ * binary. Chains already in 'cache' (when not NULL) are not solved again, and new ones are added to it.
+ * Blocks are double buffered: while the workers solve a block, the results of the previous one are written
+ * and the next one is read. They hold batch_block scalars, or one group when the groups of the dispatcher are
+ * larger.
+ * S is a dispatcher. Returns the number of scalars solved, -1 if a dispatcher could not be allocated, or -2 if
+ * the table could not be written (or did not fit in its mapping).
+ * */
+template <typename S>
+static int64_t run_batch(batch_input_t &in, batch_output_t &out, int64_t threads, bool binary = false,
+                         ChainCache *cache = NULL)
+{
+    std::vector<std::string> lines[2], results[2];
+    std::vector<scalar_ref_t> scalars[2];
+    std::vector<int64_t> order[2];
+    std::vector<S *> solvers(threads);
+    std::vector<std::thread> pool;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    std::vector<uint64_t> offsets;
+    std::atomic<int64_t> next(0);
+    int64_t count[2] = {0, 0}, generation = 0, pending = 0, total = 0, cur = 0, group = 1, capacity, t, k;
+    uint64_t end = sizeof(chain_file_header_t);
+    bool quit = false, failed = false, unwritten = false;
+    for(t = 0; t < threads; t++)
+        failed |= (solvers[t] = new_solver<S>()) == NULL;
+    if(!failed)
+        group = batch_group(solvers[0]);
+    if(binary && out.stream && !failed)
+        failed = unwritten = chain_file_begin(out.stream) != 0;
+    capacity = std::max(batch_block, group);
+    for(k = 0; k < 2; k++)
+    {
+        lines[k].resize(capacity);
+        scalars[k].resize(capacity);
+        results[k].resize(capacity);
+    }
+    for(t = 0; t < threads && !failed; t++)
+    {
+        pool.emplace_back([&, t]()
+        {
+            int64_t seen = 0, block, size, i;
+            batch_scratch_t scratch;
+            for(;;)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    wake.wait(guard, [&]() { return quit || generation != seen; });
+                    if(quit) return;
+                    seen = generation;
+                    block = cur;
+                    size = count[cur];
+                }
+                for(i = next.fetch_add(group); i < size; i = next.fetch_add(group))
+                    batch_solve_group(solvers[t], cache, scalars[block], results[block], &order[block][i],
+                                      (size-i < group) ? size-i: group, binary, scratch);
+                std::lock_guard<std::mutex> guard(lock);
+                if(--pending == 0)
+                    done.notify_one();
+            }
+        });
+    }
+    /* Write the results of a solved block, which then holds no scalars until it is read again */
+    auto flush = [&](int64_t block)
+    {
+        for(k = 0; k < count[block]; k++)
+        {
+            const std::string &result = results[block][k];
+            if(binary)
+            {
+                offsets.push_back(end);
+                end += result.size();
+            }
+            if(out.table)
+                unwritten |= mapped_table_append(out.table, result.data(), result.size()) != 0;
+            else
+                fwrite(result.data(), 1, result.size(), out.stream);
+        }
+        if(out.table)
+            mapped_table_flush(out.table);
+        total += count[block];
+        count[block] = 0;
+    };
+    count[cur] = (failed) ? 0: batch_read(in, lines[cur], scalars[cur]);
+    batch_order(scalars[cur], count[cur], group, order[cur]);
+    while(count[cur] > 0)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            next = 0;
+            pending = threads;
+            generation++;
+        }
+        wake.notify_all();
+        flush(cur ^ 1);
+        count[cur ^ 1] = batch_read(in, lines[cur ^ 1], scalars[cur ^ 1]);
+        batch_order(scalars[cur ^ 1], count[cur ^ 1], group, order[cur ^ 1]);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [&]() { return pending == 0; });
+        }
+        cur ^= 1;
+    }
+    flush(cur ^ 1);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    for(t = 0; t < (int64_t)pool.size(); t++)
+        pool[t].join();
+    for(t = 0; t < threads; t++)
+        if(solvers[t])
+            delete_solver(solvers[t]);
+    if(out.table)
+        unwritten |= mapped_table_finish(out.table, offsets) != 0;
+    else if(binary && !failed)
+        unwritten = chain_file_end(out.stream, offsets, end) != 0;
+    return (unwritten) ? -2: (failed) ? -1: total;
+}
+
+/*
+ * Cache for -c entries, -l warm and -s save, or NULL when none of them is given. Without -c, the cache holds the
+ * warm table and as many new chains.
+ * */
+static inline ChainCache *batch_open_cache(int64_t entries, const char *warm, const char *save)
+{
+    ChainCache *cache;
+    chain_table_t loaded;
+    if(entries <= 0 && warm == NULL && save == NULL)
+        return NULL;
+    if(warm != NULL && map_chain_table(warm, &loaded) != 0)
+    {
+        fprintf(stderr, "Cannot load the table %s\n", warm);
+        warm = NULL;
+    }
+    if(entries <= 0)
+        entries = (warm != NULL) ? 2*loaded.count+batch_block: batch_block;
+    cache = new ChainCache(entries);
+    if(warm != NULL)
+    {
+        fprintf(stderr, "# %" PRIu64 " chains loaded from %s\n", cache->load(&loaded), warm);
+        unmap_chain_table(&loaded);
+    }
+    return cache;
+}
+
+/* Save the cache as a table for -s save */
+static inline void batch_save_cache(ChainCache *cache, const char *save)
+{
+    FILE *out;
+    if(cache == NULL || save == NULL)
+        return;
+    if((out = fopen(save, "wb")) == NULL || cache->save(out) != 0)
+        fprintf(stderr, "Cannot save the cache to %s\n", save);
+    if(out != NULL)
+        fclose(out);
+}
+
+/*
+ * Command line of batch mode: -b [-t threads] [-o table] [-c entries] [-l table] [-s table] [-M] [-N] [-r bytes]
+ * [file].
+ * -c keeps up to 'entries' chains in a cache, -l warms the cache from a table written by -o or -s, and -s saves
+ * the cache as a table at the end.
+ * -M maps the input file in memory instead of reading it as a stream, and the table of -o, which is then written
+ * through the mapping (mapped_table_t in chain_file.h). -r bytes, which implies -M, reads the file as records of
+ * raw big-endian scalars of 'bytes' bytes each instead of lines. -N reads lines of decimal scalars, which are
+ * written in hexadecimal in the output.
+ * */
+template <typename S>
+static int batch_main(int argc, char *argv[])
+{
+    int64_t threads = std::thread::hardware_concurrency(), entries = 0, record_bytes = 0, total;
+    batch_input_t in = {stdin, NULL, 0, 0, 0, false};
+    batch_output_t out = {stdout, NULL};
+    mapped_table_t mapped;
+    const char *path = NULL, *table = NULL, *warm = NULL, *save = NULL;
+    ChainCache *cache;
+    bool map = false;
+    int k = 2;
+    while(k < argc && argv[k][0] == '-' && argv[k][1] != 0 && argv[k][2] == 0)
+    {
+        if(argv[k][1] == 'M' || argv[k][1] == 'N')
+        {
+            map |= argv[k][1] == 'M';
+            in.decimal |= argv[k][1] == 'N';
+            k++;
+            continue;
+        }
+        if(k+1 >= argc || strchr("toclsr", argv[k][1]) == NULL)
+            break;
+        switch(argv[k][1])
+        {
+        case 't': threads = atoi(argv[k+1]); break;
+        case 'o': table = argv[k+1]; break;
+        case 'c': entries = atoll(argv[k+1]); break;
+        case 'l': warm = argv[k+1]; break;
+        case 's': save = argv[k+1]; break;
+        case 'r': record_bytes = atoll(argv[k+1]); break;
+        }
+        k += 2;
+    }
+    if(threads < 1)
+        threads = 1;
+    map |= record_bytes > 0;
+    if(k < argc && strcmp(argv[k], "-") != 0)
+        path = argv[k];
+    if(map && path == NULL)
+    {
+        fprintf(stderr, "-M and -r need an input file\n");
+        return 1;
+    }
+    if(path != NULL && ((map) ? batch_map_input(path, record_bytes, in) != 0: (in.stream = fopen(path, "r")) == NULL))
+    {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+    if(table != NULL && map)
+    {
+        out.stream = NULL;
+        out.table = (mapped_table_create(table, batch_table_bound(in), &mapped) == 0) ? &mapped: NULL;
+    }
+    else if(table != NULL)
+        out.stream = fopen(table, "wb");
+    if(out.stream == NULL && out.table == NULL)
+    {
+        fprintf(stderr, "Cannot create %s\n", table);
+        batch_close_input(in);
+        return 1;
+    }
+    cache = batch_open_cache(entries, warm, save);
+
+    auto start = std::chrono::steady_clock::now();
+    total = run_batch<S>(in, out, threads, table != NULL, cache);
+    auto end = std::chrono::steady_clock::now();
+
+    batch_close_input(in);
+    if(out.stream != NULL && out.stream != stdout && fclose(out.stream) != 0)
+        total = -2;
+    batch_save_cache(cache, save);
+    delete cache;
+    if(total == -1)
+    {
+        fprintf(stderr, "Cannot allocate %" PRIu64 " solvers\n", threads);
+        return 1;
+    }
+    if(total < 0)
+    {
+        fprintf(stderr, "Cannot write the table %s\n", table);
+        return 1;
+    }
+    fprintf(stderr, "# %" PRIu64 " scalars, %" PRIu64 " threads, time: %" PRIu64 " microseg\n", total, threads,
+            (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(end-start).count());
+    return 0;
+}
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Benchmark of both engines, ChainSolver (solver.h, with pruning) and ConstantTimeSpaSolver (solver_spa.h), over
+ * random scalars of 128 to 2048 bits, and of the SPA engine solving batch_lanes scalars at once (lanes.h).
+ * To compile: g++ bench.cpp -o bench -Wall -std=c++11 -O3 -pthread
+ * To run: ./bench [-r runs] [-s seed] [-b bits]
+ * Every width gets 'runs' random scalars of exactly that many bits (200 by default, the same for both engines for
+ * a given seed), after a few warm-up solves. Each run is timed in four phases: parse (str_to_bits), divide
+ * (fill_plane, the quotients n/3^j), DP (the rest of solve()) and backtrack. The first table gives the median and
+ * the 99th percentile of the whole run and the chains per second; the second one the median of every phase.
+ * The lanes engine is timed a group of scalars at a time (parse, solve and backtrack of all of them), and every
+ * scalar of the group is counted as taking its share, so it is only in the first table.
+ * The last table compares BandedChainSolver (banded.h), with its default band and with a band of 16, against the
+ * exact chains of ChainSolver on the same scalars: median time, speedup, mean weight of both and the gap.
+ * -b bits runs one width only. The parsers are checked against each other on the scalars of every width first.
+ */
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "banded.h"
+#include "lanes.h"
+#include "solver.h"
+#include "solver_spa.h"
+
+static const int64_t warmup = 10;
+
+/* Nanoseconds of every phase of every run, and the weight of every chain */
+typedef struct {
+    std::vector<double> parse, divide, dp, backtrack, total;
+    std::vector<int64_t> weights;
+} phase_times_t;
+
+static inline int64_t ns_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+}
+
+/* The value at fraction q of the sorted times */
+static inline double percentile(std::vector<double> times, double q)
+{
+    std::sort(times.begin(), times.end());
+    return times[(int64_t)(q*(times.size()-1) + 0.5)];
+}
+
+/* Random hexadecimal scalars of exactly 'bits' bits */
+static std::vector<std::string> random_scalars(int64_t bits, int64_t count, uint64_t seed)
+{
+    std::mt19937_64 rng(seed ^ (uint64_t)bits);
+    std::vector<std::string> scalars(count);
+    int64_t k, d, digits = (bits+3)/4;
+    uint64_t top = 1ULL << ((bits-1) % 4);
+    for(k = 0; k < count; k++)
+    {
+        scalars[k].resize(digits);
+        for(d = 0; d < digits; d++)
+            scalars[k][d] = "0123456789abcdef"[rng() & 15];
+        /* Top digit in [top, 2*top) */
+        scalars[k][0] = "0123456789abcdef"[top | (rng() & (top-1))];
+    }
+    return scalars;
+}
+
+/* Decimal digits of the words of a scalar, most significant word first as in bigint_t */
+static std::string decimal_digits(std::vector<uint64_t> words)
+{
+    const uint64_t chunk = 10000000000000000000ULL;
+    std::string digits;
+    unsigned __int128 acc;
+    uint64_t r;
+    int64_t k, n;
+    while(!words.empty())
+    {
+        for(k = words.size()-1, r = 0; k >= 0; k--)
+        {
+            acc = ((unsigned __int128)r << 64) | words[k];
+            words[k] = (uint64_t)(acc / chunk);
+            r = (uint64_t)(acc % chunk);
+        }
+        while(!words.empty() && words.back() == 0)
+            words.pop_back();
+        for(n = 0; n < 19 && (r > 0 || !words.empty()); n++, r /= 10)
+            digits += '0' + r % 10;
+    }
+    std::reverse(digits.begin(), digits.end());
+    return (digits.empty()) ? "0": digits;
+}
+
+/*
+ * Check the decimal and raw parsers, dec_to_bits() and bytes_to_bits(), and the decimal lines of batch mode
+ * (batch_decimal() in batch.h) against str_to_bits() on the scalars of a width, and on 0, 1 and the largest
+ * scalar, before they are timed. Returns 0, or 1 at the first scalar where they differ.
+ * */
+template <int64_t width>
+static int check_parsers(std::vector<std::string> scalars)
+{
+    bigint_t<width> hex, dec, raw;
+    bigint_t<batch_decimal_bits> wide;
+    std::vector<uint8_t> bytes;
+    std::string line;
+    int64_t k;
+    scalars.push_back("0");
+    scalars.push_back("1");
+    scalars.push_back(std::string(width/4, 'f'));
+    for(const std::string &scalar : scalars)
+    {
+        str_to_bits(scalar.c_str(), &hex);
+        line = decimal_digits(std::vector<uint64_t>(hex.num, hex.num + bigint_t<width>::words));
+        dec_to_bits(line.c_str(), &dec);
+        /* Big-endian, with a zero byte first as in a record wider than the scalar */
+        bytes.assign((hex.msb+7)/8 + 1, 0);
+        for(k = 0; k < (hex.msb+7)/8; k++)
+            bytes[bytes.size()-1-k] = hex.num[k >> 3] >> 8*(k & 7);
+        bytes_to_bits(bytes.data(), bytes.size(), &raw);
+        batch_decimal(line, wide);
+        if(memcmp(hex.num, dec.num, sizeof(hex.num)) != 0 || hex.msb != dec.msb || hex.zero != dec.zero ||
+           memcmp(hex.num, raw.num, sizeof(hex.num)) != 0 || hex.msb != raw.msb || hex.zero != raw.zero ||
+           line != scalar)
+        {
+            fprintf(stderr, "Parsers of %" PRId64 " bits differ on %s\n", width, scalar.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Time the phases of every scalar with one solver. The division is timed on a plane of its own, right before
+ * solve() repeats it, so the DP time is the time of solve() minus the time of the division.
+ * */
+template <typename S, int64_t width>
+static void run_engine(S *solver, void (*divide)(const bigint_t<width> *, bigintptr_t<width>),
+                       const std::vector<std::string> &scalars, phase_times_t &times)
+{
+    static plane_t<width> plane;
+    bigint_t<width> n;
+    chain_t chain;
+    int64_t k, terms, parse, split, solve, walk;
+    for(k = 0; k < (int64_t)scalars.size(); k++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        str_to_bits(scalars[k].c_str(), &n);
+        parse = ns_since(start);
+        start = std::chrono::steady_clock::now();
+        fill_plane(&n, &plane, divide);
+        split = ns_since(start);
+        start = std::chrono::steady_clock::now();
+        solver->solve(n, chain);
+        solve = ns_since(start);
+        terms = 0;
+        start = std::chrono::steady_clock::now();
+        solver->backtrack(chain, [&](int64_t, int64_t, bool) { terms++; });
+        walk = ns_since(start);
+        if(terms != chain.weight)
+            fprintf(stderr, "Chain of %" PRId64 " terms for weight %" PRId64 "\n", terms, chain.weight);
+        if(k < warmup)
+            continue;
+        times.parse.push_back(parse);
+        times.divide.push_back(split);
+        times.dp.push_back((solve > split) ? solve-split: 0);
+        times.backtrack.push_back(walk);
+        times.total.push_back(parse+solve+walk);
+        times.weights.push_back(chain.weight);
+    }
+}
+
+/* Same as run_engine() for LaneChainSolver, one group of lanes at a time */
+template <int64_t width, int64_t lanes>
+static void run_lanes(LaneChainSolver<width, lanes> *solver, const std::vector<std::string> &scalars,
+                      phase_times_t &times)
+{
+    static bigint_t<width> n[lanes];
+    chain_t chains[lanes];
+    int64_t k, l, count, terms;
+    for(k = 0; k < (int64_t)scalars.size(); k += count)
+    {
+        count = ((int64_t)scalars.size()-k < lanes) ? scalars.size()-k: lanes;
+        terms = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(l = 0; l < count; l++)
+            str_to_bits(scalars[k+l].c_str(), &n[l]);
+        solver->solve(n, count, chains);
+        for(l = 0; l < count; l++)
+            solver->backtrack(l, chains[l], [&](int64_t, int64_t, bool) { terms++; });
+        double share = (double)ns_since(start)/count;
+        for(l = 0; l < count; l++)
+            terms -= chains[l].weight;
+        if(terms != 0)
+            fprintf(stderr, "Chains of %" PRId64 " terms more than their weights\n", terms);
+        if(k < warmup)
+            continue;
+        for(l = 0; l < count; l++)
+            times.total.push_back(share);
+    }
+}
+
+static void print_row(const char *engine, int64_t width, const phase_times_t &times)
+{
+    char name[32];
+    double mean = 0;
+    for(double t : times.total)
+        mean += t;
+    mean /= times.total.size();
+    snprintf(name, sizeof(name), "%s/%" PRId64, engine, width);
+    printf("%-20s %12.1f %12.1f %12.0f\n", name, percentile(times.total, 0.5)/1000,
+           percentile(times.total, 0.99)/1000, 1e9/mean);
+}
+
+/* Row of the breakdown table, kept until every width is done */
+static std::string phase_row(const char *engine, int64_t width, const phase_times_t &times)
+{
+    char name[32], row[128];
+    snprintf(name, sizeof(name), "%s/%" PRId64, engine, width);
+    snprintf(row, sizeof(row), "%-20s %12.2f %12.2f %12.2f %12.2f\n", name, percentile(times.parse, 0.5)/1000,
+             percentile(times.divide, 0.5)/1000, percentile(times.dp, 0.5)/1000, percentile(times.backtrack, 0.5)/1000);
+    return row;
+}
+
+static inline double mean_weight(const std::vector<int64_t> &weights)
+{
+    double sum = 0;
+    for(int64_t w : weights)
+        sum += w;
+    return sum/weights.size();
+}
+
+/* Row of the table of BandedChainSolver against the exact chains on the same scalars */
+static std::string gap_row(int64_t width, int64_t band, const phase_times_t &banded, const phase_times_t &exact)
+{
+    char name[32], row[128];
+    double weight = mean_weight(banded.weights), optimal = mean_weight(exact.weights);
+    snprintf(name, sizeof(name), "banded-%" PRId64 "/%" PRId64, band, width);
+    snprintf(row, sizeof(row), "%-20s %12.1f %12.2f %12.2f %12.2f %12.2f\n", name, percentile(banded.total, 0.5)/1000,
+             percentile(exact.total, 0.5)/percentile(banded.total, 0.5), weight, optimal,
+             100*(weight-optimal)/optimal);
+    return row;
+}
+
+/* Banded chains of the scalars of the exact ones, with the default band and with a band of 16 */
+template <int64_t width>
+static int bench_banded(const std::vector<std::string> &scalars, const phase_times_t &exact,
+                        std::vector<std::string> &gaps)
+{
+    const int64_t bands[] = {BandedChainSolver<width>::default_band, 16};
+    for(int64_t band : bands)
+    {
+        phase_times_t times;
+        BandedChainSolver<width> *banded = new_solver<BandedChainSolver<width>>(band);
+        if(banded == NULL)
+        {
+            fprintf(stderr, "Could not allocate the %" PRId64 "-bit banded solver\n", width);
+            return 1;
+        }
+        run_engine(banded, divide_by_3<width>, scalars, times);
+        delete_solver(banded);
+        gaps.push_back(gap_row(width, band, times, exact));
+    }
+    return 0;
+}
+
+/* Both engines on the same scalars of 'width' bits. Returns 0, or 1 if a solver cannot be allocated */
+template <int64_t width>
+static int bench_width(int64_t runs, uint64_t seed, std::vector<std::string> &phases, std::vector<std::string> &gaps)
+{
+    std::vector<std::string> scalars = random_scalars(width, runs+warmup, seed);
+    phase_times_t pruned, constant, batched;
+    if(check_parsers<width>(scalars) != 0)
+        return 1;
+    ChainSolver<width> *fast = new_solver<ChainSolver<width>>();
+    ConstantTimeSpaSolver<width> *spa = new_solver<ConstantTimeSpaSolver<width>>();
+    LaneChainSolver<width> *lanes = new_solver<LaneChainSolver<width>>();
+    if(fast == NULL || spa == NULL || lanes == NULL)
+    {
+        if(fast)
+            delete_solver(fast);
+        if(spa)
+            delete_solver(spa);
+        if(lanes)
+            delete_solver(lanes);
+        fprintf(stderr, "Could not allocate the %" PRId64 "-bit solvers\n", width);
+        return 1;
+    }
+    run_engine(fast, divide_by_3<width>, scalars, pruned);
+    run_engine(spa, divide_by_3_ct<width>, scalars, constant);
+    run_lanes(lanes, scalars, batched);
+    delete_solver(fast);
+    delete_solver(spa);
+    delete_solver(lanes);
+    print_row("pruned", width, pruned);
+    print_row("spa", width, constant);
+    print_row("spa-lanes", width, batched);
+    fflush(stdout);
+    phases.push_back(phase_row("pruned", width, pruned));
+    phases.push_back(phase_row("spa", width, constant));
+    return bench_banded<width>(scalars, pruned, gaps);
+}
+
+int main(int argc, char *argv[])
+{
+    int64_t runs = 200, bits = 0, k, status = 0;
+    uint64_t seed = 23;
+    std::vector<std::string> phases, gaps;
+    for(k = 1; k+1 < argc; k += 2)
+    {
+        if(strcmp(argv[k], "-r") == 0)
+            runs = atoll(argv[k+1]);
+        else if(strcmp(argv[k], "-s") == 0)
+            seed = strtoull(argv[k+1], NULL, 0);
+        else if(strcmp(argv[k], "-b") == 0)
+            bits = atoll(argv[k+1]);
+        else
+            break;
+    }
+    if(k < argc || runs < 1)
+    {
+        printf("\nUsage: %s [-r runs] [-s seed] [-b bits]\n\n", argv[0]);
+        exit(1);
+    }
+    printf("# %" PRId64 " random scalars per width after %" PRId64 " warm-up solves, seed %" PRIu64 "\n",
+           runs, warmup, seed);
+    printf("%-20s %12s %12s %12s\n", "Benchmark", "median(us)", "p99(us)", "chains/s");
+    printf("%.*s\n", 59, "-----------------------------------------------------------");
+    if(bits == 0 || bits == 128) status |= bench_width<128>(runs, seed, phases, gaps);
+    if(bits == 0 || bits == 256) status |= bench_width<256>(runs, seed, phases, gaps);
+    if(bits == 0 || bits == 384) status |= bench_width<384>(runs, seed, phases, gaps);
+    if(bits == 0 || bits == 512) status |= bench_width<512>(runs, seed, phases, gaps);
+    if(bits == 0 || bits == 1024) status |= bench_width<1024>(runs, seed, phases, gaps);
+    if(bits == 0 || bits == 2048) status |= bench_width<2048>(runs, seed, phases, gaps);
+    if(phases.empty())
+    {
+        if(status == 0)
+            fprintf(stderr, "The widths are 128, 256, 384, 512, 1024 and 2048 bits\n");
+        return 1;
+    }
+    printf("\n# Median of every phase\n");
+    printf("%-20s %12s %12s %12s %12s\n", "Benchmark", "parse(us)", "divide(us)", "dp(us)", "backtrack(us)");
+    printf("%.*s\n", 72, "------------------------------------------------------------------------");
+    for(const std::string &row : phases)
+        fputs(row.c_str(), stdout);
+    printf("\n# BandedChainSolver against the exact chains of ChainSolver\n");
+    printf("%-20s %12s %12s %12s %12s %12s\n", "Benchmark", "median(us)", "speedup", "weight", "optimal", "gap(%)");
+    printf("%.*s\n", 85, "-------------------------------------------------------------------------------------");
+    for(const std::string &row : gaps)
+        fputs(row.c_str(), stdout);
+    return status;
+}
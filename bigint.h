@@ -0,0 +1,195 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Fixed-size big integers of up to 'width' bits, stored as an array of 64-bit words
+ * (least significant word first).
+ */
+#ifndef BIGINT_H
+#define BIGINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * 'num' holds the number with its least significant word first. There are enough words to address
+ * bits 0 to width+4, the furthest positions looked at by the DP.
+ * 'msb' is the bit length of the number (position of the most significant bit plus one), zero for 0.
+ * */
+template <int64_t width>
+struct bigint_t {
+    static const int64_t words = (width+4)/64 + 1;
+    uint64_t num[words];
+    int64_t msb;
+    bool zero;
+};
+
+template <int64_t width>
+using bigintptr_t = bigint_t<width>*;
+
+/* Value of the i-th bit of an array of words */
+static inline bool get_bit(const uint64_t *w, int64_t i)
+{
+    return (w[i >> 6] >> (i & 63)) & 1;
+}
+
+/* Number of leading zero bits of a non-zero word */
+static inline int64_t leading_zeros(uint64_t w)
+{
+    return __builtin_clzll(w);
+}
+
+/*
+ * Truncate a to 'width' bits and recompute 'msb' and 'zero' from its words,
+ * looking for the highest non-zero word and counting its leading zeros.
+ * */
+template <int64_t width>
+static inline void set_msb(bigintptr_t<width> a)
+{
+    const int64_t words = bigint_t<width>::words;
+    int64_t k;
+    for(k = width/64; k < words; k++)
+        a->num[k] &= (64*k+64 <= width) ? ~0ULL: (64*k < width) ? (1ULL << (width-64*k))-1: 0;
+    a->msb = 0;
+    for(k = words-1; k >= 0; k--)
+    {
+        if(a->num[k])
+        {
+            a->msb = 64*k + 64 - leading_zeros(a->num[k]);
+            break;
+        }
+    }
+    a->zero = (a->msb > 0) ? false: true;
+}
+
+/* Convert big integers from string hexadecimal representation, placing every digit directly in its word */
+template <int64_t width>
+static inline void str_to_bits(const char *orig, bigintptr_t<width> dest)
+{
+    uint64_t digit;
+    int64_t bitcount = 0;
+    memset(dest->num, 0, sizeof(dest->num));
+    for(int64_t i = strlen(orig)-1; i >= 0 && bitcount < width; i--)
+    {
+        digit = (orig[i] > '9') ? (orig[i] &~ 0x20)-'A'+10: (orig[i]-'0');
+        dest->num[bitcount >> 6] |= (digit & 15) << (bitcount & 63);
+        bitcount += 4;
+    }
+    set_msb(dest);
+}
+
+/* Convert big integers from string decimal representation, 19 digits (the most that fit in a word) at a time */
+template <int64_t width>
+static inline void dec_to_bits(const char *orig, bigintptr_t<width> dest)
+{
+    uint64_t chunk, scale;
+    unsigned __int128 acc;
+    int64_t len = strlen(orig), i = 0, k, n;
+    memset(dest->num, 0, sizeof(dest->num));
+    while(i < len)
+    {
+        chunk = 0;
+        scale = 1;
+        for(n = 0; n < 19 && i < len; n++, i++)
+        {
+            chunk = 10*chunk + (orig[i]-'0');
+            scale *= 10;
+        }
+        /* num = num*scale + chunk */
+        for(k = 0; k < bigint_t<width>::words; k++)
+        {
+            acc = (unsigned __int128)dest->num[k]*scale + chunk;
+            dest->num[k] = (uint64_t)acc;
+            chunk = (uint64_t)(acc >> 64);
+        }
+    }
+    set_msb(dest);
+}
+
+/* Convert big integers from raw big-endian bytes */
+template <int64_t width>
+static inline void bytes_to_bits(const uint8_t *orig, size_t len, bigintptr_t<width> dest)
+{
+    int64_t bitcount = 0;
+    memset(dest->num, 0, sizeof(dest->num));
+    for(int64_t i = len-1; i >= 0 && bitcount < width; i--)
+    {
+        dest->num[bitcount >> 6] |= (uint64_t)orig[i] << (bitcount & 63);
+        bitcount += 8;
+    }
+    set_msb(dest);
+}
+
+/*
+ * Divide by 3 one 64-bit word at a time, from the most significant word down.
+ * Since 2^64 = 3*0x5555555555555555 + 1, a word w with remainder r (0, 1 or 2) coming from the upper words gives
+ * (r*2^64 + w)/3 = r*0x5555555555555555 + w/3 + (w%3 + r)/3, and the new remainder is (w%3 + r)%3.
+ * Divisions by the constant 3 are turned into multiplications by the compiler.
+ * */
+template <int64_t width>
+static inline void divide_by_3(const bigint_t<width> *orig, bigintptr_t<width> dest)
+{
+    uint64_t r = 0, low;
+    int64_t k, top = (orig->msb+63)/64 - 1;
+    dest->msb = 0;
+    for(k = bigint_t<width>::words-1; k > top; k--)
+        dest->num[k] = 0;
+    for(; k >= 0; k--)
+    {
+        low = orig->num[k]%3 + r;
+        dest->num[k] = r*0x5555555555555555ULL + orig->num[k]/3 + low/3;
+        r = low%3;
+        if(dest->num[k] && !dest->msb)
+            dest->msb = 64*k + 64 - leading_zeros(dest->num[k]);
+    }
+    dest->zero = (dest->msb > 0) ? false: true;
+}
+
+/*
+ * Divide by a small odd constant k in the same way as divide_by_3: with 2^64 = k*Q + R, a word w with remainder r
+ * from the upper words gives (r*2^64 + w)/k = r*Q + w/k + (w%k + r*R)/k, and the new remainder is (w%k + r*R)%k.
+ * r*R is below k^2, so nothing overflows for k below 2^31. divide_by_k<5> gives the quotients of 2-3-5 chains.
+ * */
+template <uint64_t k, int64_t width>
+static inline void divide_by_k(const bigint_t<width> *orig, bigintptr_t<width> dest)
+{
+    static_assert(k > 1 && (k & 1) && k < (1ULL << 31), "k must be small and odd");
+    const uint64_t Q = ~0ULL/k, R = 0-k*Q;
+    uint64_t r = 0, low;
+    int64_t n, top = (orig->msb+63)/64 - 1;
+    dest->msb = 0;
+    for(n = bigint_t<width>::words-1; n > top; n--)
+        dest->num[n] = 0;
+    for(; n >= 0; n--)
+    {
+        low = orig->num[n]%k + r*R;
+        dest->num[n] = r*Q + orig->num[n]/k + low/k;
+        r = low%k;
+        if(dest->num[n] && !dest->msb)
+            dest->msb = 64*n + 64 - leading_zeros(dest->num[n]);
+    }
+    dest->zero = (dest->msb > 0) ? false: true;
+}
+
+/*
+ * Constant-time version of divide_by_3 for the SPA engine.
+ * All words are processed regardless of the size of the number, and the bit length of the quotient
+ * is selected with a mask instead of a branch, so the sequence of operations does not depend on the scalar.
+ * */
+template <int64_t width>
+static inline void divide_by_3_ct(const bigint_t<width> *orig, bigintptr_t<width> dest)
+{
+    uint64_t r = 0, low, mask, msb = 0;
+    for(int64_t k = bigint_t<width>::words-1; k >= 0; k--)
+    {
+        low = orig->num[k]%3 + r;
+        dest->num[k] = r*0x5555555555555555ULL + orig->num[k]/3 + low/3;
+        r = low%3;
+        /* All ones if this is the highest non-zero word of the quotient */
+        mask = -(uint64_t)((dest->num[k] != 0) & (msb == 0));
+        msb |= mask & (64*k + 64 - leading_zeros(dest->num[k] | 1));
+    }
+    dest->msb = msb;
+    dest->zero = (msb > 0) ? false: true;
+}
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Bounded in-process cache of solved chains, for scalars that come back again and again.
+ */
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "chain_file.h"
+
+/*
+ * Chains are keyed by the words of the scalar (see append_scalar() in chain_file.h) and stored as packed terms.
+ * The keys are spread by their hash over 'cache_shards' shards, each with its own lock, so threads looking up
+ * different scalars rarely wait for each other. Every shard holds up to capacity/cache_shards chains and evicts
+ * with the CLOCK policy: a hit marks the entry as referenced, and the hand of the shard gives referenced entries
+ * a second chance, evicting the first one that was not used since the hand last passed it.
+ *
+ * The cache can be saved as a chain table (chain_file.h) and warmed from one at startup.
+ *
+ * A hit returns orders of magnitude faster than a solve, so the time tells whether a scalar was seen before.
+ * That is the point for long-term scalars, but it must be kept in mind for the constant-time solvers.
+ * */
+static const int64_t cache_shards = 16;
+
+class ChainCache
+{
+public:
+    explicit ChainCache(int64_t capacity) : per_shard((capacity+cache_shards-1)/cache_shards)
+    {
+        if(per_shard < 1)
+            per_shard = 1;
+    }
+
+    /* Copy the packed terms of the chain of 'scalar' into 'terms'. Returns false if it is not cached */
+    bool lookup(const std::string &scalar, std::vector<uint32_t> &terms)
+    {
+        shard_t &shard = shard_of(scalar);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto found = shard.index.find(scalar);
+        if(found == shard.index.end())
+            return false;
+        entry_t &entry = shard.entries[found->second];
+        entry.referenced = true;
+        terms = entry.terms;
+        return true;
+    }
+
+    void insert(const std::string &scalar, const uint32_t *terms, int64_t weight)
+    {
+        shard_t &shard = shard_of(scalar);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        int64_t slot;
+        auto found = shard.index.find(scalar);
+        if(found != shard.index.end())
+            return;
+        if((int64_t)shard.entries.size() < per_shard)
+        {
+            slot = shard.entries.size();
+            shard.entries.emplace_back();
+        }
+        else
+        {
+            while(shard.entries[shard.hand].referenced)
+            {
+                shard.entries[shard.hand].referenced = false;
+                shard.hand = (shard.hand+1) % per_shard;
+            }
+            slot = shard.hand;
+            shard.hand = (shard.hand+1) % per_shard;
+            shard.index.erase(shard.entries[slot].scalar);
+        }
+        shard.entries[slot].scalar = scalar;
+        shard.entries[slot].terms.assign(terms, terms+weight);
+        shard.entries[slot].referenced = false;
+        shard.index[scalar] = slot;
+    }
+
+    /* Insert every solved chain of a table. Returns the number of chains inserted */
+    int64_t load(const chain_table_t *table)
+    {
+        chain_record_t record;
+        uint64_t k;
+        int64_t count = 0;
+        for(k = 0; k < table->count; k++)
+        {
+            if(chain_table_get(table, k, &record) == 0 && record.weight != chain_unsolved)
+            {
+                insert(std::string((const char *)record.scalar, 4*record.scalar_words), record.terms, record.weight);
+                count++;
+            }
+        }
+        return count;
+    }
+
+    /* Write every cached chain to 'out' as a chain table. Returns 0, or -1 if it cannot be written */
+    int save(FILE *out)
+    {
+        std::vector<uint64_t> offsets;
+        std::string record;
+        uint64_t end = sizeof(chain_file_header_t);
+        int64_t s;
+        if(chain_file_begin(out) != 0)
+            return -1;
+        for(s = 0; s < cache_shards; s++)
+        {
+            std::lock_guard<std::mutex> guard(shards[s].lock);
+            for(const entry_t &entry : shards[s].entries)
+            {
+                record.clear();
+                append_record(record, entry.scalar, entry.terms.size(), entry.terms.data());
+                if(fwrite(record.data(), 1, record.size(), out) != record.size())
+                    return -1;
+                offsets.push_back(end);
+                end += record.size();
+            }
+        }
+        return chain_file_end(out, offsets, end);
+    }
+
+private:
+    typedef struct {
+        std::string scalar;
+        std::vector<uint32_t> terms;
+        bool referenced;
+    } entry_t;
+
+    typedef struct {
+        std::mutex lock;
+        std::unordered_map<std::string, int64_t> index;
+        std::vector<entry_t> entries;
+        int64_t hand = 0;
+    } shard_t;
+
+    shard_t shards[cache_shards];
+    int64_t per_shard;
+
+    shard_t &shard_of(const std::string &scalar)
+    {
+        /*
+         * The low bits also pick the bucket inside the shard, so the shard comes from a mix of all of them. size_t
+         * may have 32 bits only (lib23chains), so the hash is mixed as a 64-bit word.
+         * */
+        uint64_t h = std::hash<std::string>()(scalar);
+        h ^= h >> 29;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 32;
+        return shards[h % cache_shards];
+    }
+
+    ChainCache(const ChainCache &);
+    ChainCache &operator=(const ChainCache &);
+};
+
+#endif
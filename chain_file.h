@@ -0,0 +1,302 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Binary tables of chains, which scalar multiplication code can map into memory and read in place.
+ */
+#ifndef CHAIN_FILE_H
+#define CHAIN_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "dp.h"
+
+/*
+ * Layout of a table of 'count' chains, in host byte order (little-endian on x86 and ARM):
+ *
+ *   header     chain_file_header_t, 32 bytes
+ *   records    one per scalar, in input order, each a sequence of uint32_t words:
+ *                  scalar_words, weight,
+ *                  scalar_words words of the scalar, least significant first,
+ *                  weight packed terms (see pack_term() in dp.h), from the largest to the smallest
+ *   index      'count' uint64_t offsets of the records from the start of the file, 8-byte aligned
+ *
+ * A scalar without a chain (larger than every width) has weight chain_unsolved and no terms.
+ * */
+static const uint32_t chain_file_magic = 0x48433332; /* "23CH" */
+static const uint32_t chain_file_version = 1;
+static const uint32_t chain_unsolved = 0xffffffff;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+    uint64_t index; /* offset of the index */
+    uint64_t size; /* of the whole file */
+} chain_file_header_t;
+
+/* One record of a table, pointing into the mapped file */
+typedef struct {
+    uint32_t scalar_words;
+    uint32_t weight;
+    const uint32_t *scalar;
+    const uint32_t *terms;
+} chain_record_t;
+
+typedef struct {
+    const uint8_t *base;
+    uint64_t size;
+    uint64_t count;
+    const uint64_t *index;
+} chain_table_t;
+
+static inline void append_word(std::string &out, uint32_t word)
+{
+    out.append((const char *)&word, sizeof(word));
+}
+
+/* Append the words of a hexadecimal scalar, least significant first and without leading zero words */
+static inline void append_scalar(std::string &out, const char *hex)
+{
+    int64_t len, words, k, d;
+    uint32_t word, digit;
+    while(*hex == '0')
+        hex++;
+    len = strlen(hex);
+    words = (len+7)/8;
+    for(k = 0; k < words; k++)
+    {
+        word = 0;
+        for(d = (len-8*k-8 > 0) ? len-8*k-8: 0; d < len-8*k; d++)
+        {
+            digit = (hex[d] > '9') ? (hex[d] &~ 0x20)-'A'+10: (hex[d]-'0');
+            word = (word << 4) | (digit & 15);
+        }
+        append_word(out, word);
+    }
+}
+
+/* Same as append_scalar() for a scalar of 'bytes' raw big-endian bytes */
+static inline void append_scalar(std::string &out, const uint8_t *raw, int64_t bytes)
+{
+    int64_t words, k, b;
+    uint32_t word;
+    while(bytes > 0 && *raw == 0)
+    {
+        raw++;
+        bytes--;
+    }
+    words = (bytes+3)/4;
+    for(k = 0; k < words; k++)
+    {
+        word = 0;
+        for(b = (bytes-4*k-4 > 0) ? bytes-4*k-4: 0; b < bytes-4*k; b++)
+            word = (word << 8) | raw[b];
+        append_word(out, word);
+    }
+}
+
+/* Append the record of a scalar, given by its words from append_scalar(), with 'weight' packed terms */
+static inline void append_record(std::string &out, const std::string &scalar, uint32_t weight, const uint32_t *terms)
+{
+    append_word(out, scalar.size()/4);
+    append_word(out, weight);
+    out.append(scalar);
+    if(weight != chain_unsolved)
+        out.append((const char *)terms, 4*weight);
+}
+
+/* Write a header to be completed by chain_file_end(). Returns 0, or -1 if it cannot be written */
+static inline int chain_file_begin(FILE *out)
+{
+    chain_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    return (fwrite(&header, sizeof(header), 1, out) == 1) ? 0: -1;
+}
+
+/* Header of a table of 'count' records that end at offset 'end', with the index after them */
+static inline chain_file_header_t chain_file_header(uint64_t count, uint64_t end)
+{
+    chain_file_header_t header;
+    header.magic = chain_file_magic;
+    header.version = chain_file_version;
+    header.count = count;
+    header.index = (end+7) &~ (uint64_t)7;
+    header.size = header.index + 8*header.count;
+    return header;
+}
+
+/*
+ * Write the index of the records at 'offsets' after the last one, which ends at offset 'end', and fill in the
+ * header. 'out' must be seekable. Returns 0, or -1 if it cannot be written.
+ * */
+static inline int chain_file_end(FILE *out, const std::vector<uint64_t> &offsets, uint64_t end)
+{
+    chain_file_header_t header = chain_file_header(offsets.size(), end);
+    uint32_t pad = 0;
+    if(header.index > end && fwrite(&pad, header.index-end, 1, out) != 1)
+        return -1;
+    if(header.count > 0 && fwrite(offsets.data(), 8, header.count, out) != header.count)
+        return -1;
+    if(fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1)
+        return -1;
+    return (fflush(out) == 0) ? 0: -1;
+}
+
+/*
+ * A table written through a shared mapping of its file, for batches too large to go through a stream. The file is
+ * preallocated (sparse) to the largest size the table can have and mapped once, records are copied in as they
+ * come, and the writeback of every block is started with msync(MS_ASYNC) without waiting for it. At the end the
+ * file is cut to the size of the table.
+ * */
+typedef struct {
+    int fd;
+    uint8_t *base;
+    uint64_t capacity;
+    uint64_t end; /* of the last record */
+    uint64_t synced; /* end of the records whose writeback has been started */
+} mapped_table_t;
+
+/*
+ * Create the file of a table of at most 'capacity' bytes, header and index included.
+ * Returns 0, or -1 if it cannot be created or mapped.
+ * */
+static inline int mapped_table_create(const char *path, uint64_t capacity, mapped_table_t *table)
+{
+    void *data;
+    table->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(table->fd < 0)
+        return -1;
+    capacity = (capacity+7) &~ (uint64_t)7;
+    if(capacity < sizeof(chain_file_header_t) || ftruncate(table->fd, capacity) != 0 ||
+       (data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, table->fd, 0)) == MAP_FAILED)
+    {
+        close(table->fd);
+        return -1;
+    }
+    table->base = (uint8_t *)data;
+    table->capacity = capacity;
+    table->end = table->synced = sizeof(chain_file_header_t);
+    return 0;
+}
+
+/* Copy records after the last ones. Returns 0, or -1 if they do not fit */
+static inline int mapped_table_append(mapped_table_t *table, const void *data, uint64_t size)
+{
+    if(size > table->capacity - table->end)
+        return -1;
+    memcpy(table->base + table->end, data, size);
+    table->end += size;
+    return 0;
+}
+
+/* Start writing back the records appended since the last call */
+static inline void mapped_table_flush(mapped_table_t *table)
+{
+    uint64_t start = table->synced &~ (uint64_t)(sysconf(_SC_PAGESIZE)-1);
+    if(table->end > table->synced)
+        msync(table->base + start, table->end - start, MS_ASYNC);
+    table->synced = table->end;
+}
+
+/*
+ * Write the index of the records at 'offsets' and the header, cut the file to the size of the table and unmap it.
+ * Returns 0, or -1 if the table does not fit or cannot be written.
+ * */
+static inline int mapped_table_finish(mapped_table_t *table, const std::vector<uint64_t> &offsets)
+{
+    chain_file_header_t header = chain_file_header(offsets.size(), table->end);
+    int status = -1;
+    if(header.size <= table->capacity)
+    {
+        memset(table->base + table->end, 0, header.index - table->end);
+        if(header.count > 0)
+            memcpy(table->base + header.index, offsets.data(), 8*header.count);
+        memcpy(table->base, &header, sizeof(header));
+        status = (msync(table->base, header.size, MS_ASYNC) == 0) ? 0: -1;
+    }
+    munmap(table->base, table->capacity);
+    if(ftruncate(table->fd, (status == 0) ? header.size: 0) != 0)
+        status = -1;
+    if(close(table->fd) != 0)
+        status = -1;
+    return status;
+}
+
+/*
+ * Check the header and index of a table of 'size' bytes at 'data' (8-byte aligned, as from mmap).
+ * Returns 0, or -1 if it is not a valid table.
+ * */
+static inline int open_chain_table(const void *data, uint64_t size, chain_table_t *table)
+{
+    const chain_file_header_t *header = (const chain_file_header_t *)data;
+    uint64_t k;
+    if(size < sizeof(chain_file_header_t) || header->magic != chain_file_magic ||
+       header->version != chain_file_version || header->size != size || (header->index & 7) ||
+       header->index < sizeof(chain_file_header_t) || header->count > (size-header->index)/8 ||
+       header->index + 8*header->count != size)
+        return -1;
+    table->base = (const uint8_t *)data;
+    table->size = size;
+    table->count = header->count;
+    table->index = (const uint64_t *)(table->base + header->index);
+    for(k = 0; k < table->count; k++)
+        if((table->index[k] & 3) || table->index[k] < sizeof(chain_file_header_t) ||
+           table->index[k]+8 > header->index)
+            return -1;
+    return 0;
+}
+
+/* Record k of a table checked by open_chain_table(). Returns 0, or -1 if k or the record is out of bounds */
+static inline int chain_table_get(const chain_table_t *table, uint64_t k, chain_record_t *record)
+{
+    const uint32_t *words;
+    uint64_t length, room;
+    if(k >= table->count)
+        return -1;
+    words = (const uint32_t *)(table->base + table->index[k]);
+    record->scalar_words = words[0];
+    record->weight = words[1];
+    length = (uint64_t)words[0] + ((words[1] == chain_unsolved) ? 0: words[1]);
+    room = ((const uint8_t *)table->index - table->base - table->index[k] - 8)/4;
+    if(length > room)
+        return -1;
+    record->scalar = words+2;
+    record->terms = words+2+words[0];
+    return 0;
+}
+
+/* Map a table file into memory and check it. Returns 0, or -1 if it cannot be mapped or is not a valid table */
+static inline int map_chain_table(const char *path, chain_table_t *table)
+{
+    struct stat st;
+    void *data;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) != 0 || st.st_size == 0 ||
+       (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    if(open_chain_table(data, st.st_size, table) != 0)
+    {
+        munmap(data, st.st_size);
+        return -1;
+    }
+    return 0;
+}
+
+static inline void unmap_chain_table(chain_table_t *table)
+{
+    munmap((void *)table->base, table->size);
+}
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Reference group backend for ChainExecutor (exec.h): the curve y^2 = x^3 - 3x + 7 in short Weierstrass form over
+ * GF(2^61-1), in Jacobian coordinates. The field fits in a machine word, so the formulas are exact and cheap to
+ * check; it is meant for tests and for comparing evaluation strategies, not for cryptography.
+ */
+#ifndef CURVE_H
+#define CURVE_H
+
+#include <stdint.h>
+
+/* (X, Y, Z) stands for the affine point (X/Z^2, Y/Z^3), and Z = 0 for the point at infinity */
+typedef struct {
+    uint64_t X;
+    uint64_t Y;
+    uint64_t Z;
+} jacobian_t;
+
+class ReferenceCurve
+{
+public:
+    typedef jacobian_t point_t;
+
+    static const uint64_t p = (1ULL << 61) - 1;
+    static const uint64_t b = 7;
+
+    void zero(point_t &r) const
+    {
+        r.X = r.Y = 1;
+        r.Z = 0;
+    }
+
+    void neg(point_t &r, const point_t &a) const
+    {
+        r.X = a.X;
+        r.Y = sub(0, a.Y);
+        r.Z = a.Z;
+    }
+
+    /* dbl-2001-b, for a = -3 */
+    void dbl(point_t &r, const point_t &a) const
+    {
+        uint64_t delta = sqr(a.Z), gamma = sqr(a.Y), beta = mul(a.X, gamma);
+        uint64_t alpha = mul(3, mul(sub(a.X, delta), add(a.X, delta)));
+        uint64_t X3 = sub(sqr(alpha), mul(8, beta));
+        r.Z = sub(sub(sqr(add(a.Y, a.Z)), gamma), delta);
+        r.Y = sub(mul(alpha, sub(mul(4, beta), X3)), mul(8, sqr(gamma)));
+        r.X = X3;
+    }
+
+    /* tpl-2007-bl, with a*ZZ^2 = -3*ZZ^2 */
+    void tpl(point_t &r, const point_t &a) const
+    {
+        uint64_t XX = sqr(a.X), YY = sqr(a.Y), ZZ = sqr(a.Z), YYYY = sqr(YY);
+        uint64_t M = sub(mul(3, XX), mul(3, sqr(ZZ))), MM = sqr(M);
+        uint64_t E = sub(mul(6, sub(sub(sqr(add(a.X, YY)), XX), YYYY)), MM), EE = sqr(E);
+        uint64_t T = mul(16, YYYY), U = sub(sub(sub(sqr(add(M, E)), MM), EE), T);
+        r.Z = sub(sub(sqr(add(a.Z, E)), ZZ), EE);
+        r.Y = mul(8, mul(a.Y, sub(mul(U, sub(T, U)), mul(E, EE))));
+        r.X = mul(4, sub(mul(a.X, EE), mul(4, mul(YY, U))));
+    }
+
+    /* add-2007-bl, or madd-2007-bl (mixed addition) when c.Z = 1 */
+    void add(point_t &r, const point_t &a, const point_t &c) const
+    {
+        uint64_t Z1Z1, Z2Z2, U1, U2, S1, S2, H, I, J, R, V, X3;
+        if(a.Z == 0)
+        {
+            r = c;
+            return;
+        }
+        if(c.Z == 0)
+        {
+            r = a;
+            return;
+        }
+        Z1Z1 = sqr(a.Z);
+        Z2Z2 = (c.Z == 1) ? 1: sqr(c.Z);
+        U1 = (c.Z == 1) ? a.X: mul(a.X, Z2Z2);
+        U2 = mul(c.X, Z1Z1);
+        S1 = (c.Z == 1) ? a.Y: mul(a.Y, mul(c.Z, Z2Z2));
+        S2 = mul(c.Y, mul(a.Z, Z1Z1));
+        H = sub(U2, U1);
+        R = add(sub(S2, S1), sub(S2, S1));
+        if(H == 0)
+        {
+            if(R == 0)
+                dbl(r, a);
+            else
+                zero(r);
+            return;
+        }
+        I = sqr(add(H, H));
+        J = mul(H, I);
+        V = mul(U1, I);
+        X3 = sub(sub(sqr(R), J), add(V, V));
+        r.Y = sub(mul(R, sub(V, X3)), mul(2, mul(S1, J)));
+        r.Z = mul(sub(sub(sqr(add(a.Z, c.Z)), Z1Z1), Z2Z2), H);
+        r.X = X3;
+    }
+
+    bool equal(const point_t &a, const point_t &c) const
+    {
+        if(a.Z == 0 || c.Z == 0)
+            return a.Z == c.Z;
+        uint64_t Z1Z1 = sqr(a.Z), Z2Z2 = sqr(c.Z);
+        return mul(a.X, Z2Z2) == mul(c.X, Z1Z1) && mul(a.Y, mul(c.Z, Z2Z2)) == mul(c.Y, mul(a.Z, Z1Z1));
+    }
+
+    bool on_curve(const point_t &a) const
+    {
+        if(a.Z == 0)
+            return true;
+        uint64_t Z2 = sqr(a.Z), Z4 = sqr(Z2), Z6 = mul(Z2, Z4);
+        return sqr(a.Y) == add(sub(mul(a.X, sqr(a.X)), mul(3, mul(a.X, Z4))), mul(b, Z6));
+    }
+
+    /* The point of smallest x >= x0 on the curve, in affine form (Z = 1) */
+    void point(point_t &r, uint64_t x0) const
+    {
+        uint64_t x, y2, y;
+        for(x = x0 % p; ; x = add(x, 1))
+        {
+            y2 = add(sub(mul(x, sqr(x)), mul(3, x)), b);
+            /* p = 3 mod 4, so a square root of y2 is y2^((p+1)/4) */
+            y = power(y2, (p+1)/4);
+            if(sqr(y) == y2)
+                break;
+        }
+        r.X = x;
+        r.Y = y;
+        r.Z = 1;
+    }
+
+private:
+    static uint64_t add(uint64_t x, uint64_t y)
+    {
+        uint64_t s = x+y;
+        return (s >= p) ? s-p: s;
+    }
+
+    static uint64_t sub(uint64_t x, uint64_t y)
+    {
+        return (x >= y) ? x-y: x+p-y;
+    }
+
+    static uint64_t mul(uint64_t x, uint64_t y)
+    {
+        unsigned __int128 t = (unsigned __int128)x*y;
+        uint64_t s = ((uint64_t)t & p) + (uint64_t)(t >> 61);
+        return (s >= p) ? s-p: s;
+    }
+
+    static uint64_t sqr(uint64_t x)
+    {
+        return mul(x, x);
+    }
+
+    static uint64_t power(uint64_t x, uint64_t e)
+    {
+        uint64_t r = 1;
+        for(; e; e >>= 1, x = sqr(x))
+            if(e & 1)
+                r = mul(r, x);
+        return r;
+    }
+};
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * One solver per bit width, picking for every scalar the smallest width that holds it.
+ */
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "dp.h"
+
+/* Widths compiled into the programs, smallest first. -D BITS=n keeps only n bits. */
+#ifdef BITS
+    #define CHAIN_WIDTHS BITS
+#else
+    #define CHAIN_WIDTHS 64, 128, 256, 384, 512, 1024, 2048, 4096
+#endif
+
+/* Bit length of a scalar in hexadecimal representation */
+static inline int64_t hex_bits(const char *hex)
+{
+    int64_t len, digit;
+    while(*hex == '0')
+        hex++;
+    len = strlen(hex);
+    if(len == 0)
+        return 0;
+    digit = (hex[0] > '9') ? (hex[0] &~ 0x20)-'A'+10: (hex[0]-'0');
+    return 4*(len-1) + 64 - __builtin_clzll((digit & 15) | 1);
+}
+
+/* Bit length of a scalar of 'bytes' raw big-endian bytes */
+static inline int64_t raw_bits(const uint8_t *raw, int64_t bytes)
+{
+    while(bytes > 0 && *raw == 0)
+    {
+        raw++;
+        bytes--;
+    }
+    return (bytes == 0) ? 0: 8*(bytes-1) + 64 - __builtin_clzll(raw[0]);
+}
+
+/*
+ * A scalar where it was read, parsed straight into the words of the solver that takes it: hexadecimal digits
+ * ending in a zero, or when 'raw' is set a record of 'bytes' raw big-endian bytes (mapped input, batch.h)
+ * */
+typedef struct {
+    const char *hex;
+    const uint8_t *raw;
+    int64_t bytes;
+} scalar_ref_t;
+
+static inline scalar_ref_t hex_scalar(const char *hex)
+{
+    scalar_ref_t scalar = {hex, NULL, 0};
+    return scalar;
+}
+
+static inline scalar_ref_t raw_scalar(const uint8_t *raw, int64_t bytes)
+{
+    scalar_ref_t scalar = {NULL, raw, bytes};
+    return scalar;
+}
+
+static inline int64_t scalar_bits(const scalar_ref_t &scalar)
+{
+    return (scalar.raw) ? raw_bits(scalar.raw, scalar.bytes): hex_bits(scalar.hex);
+}
+
+template <int64_t width>
+static inline void parse_scalar(const scalar_ref_t &scalar, bigintptr_t<width> n)
+{
+    if(scalar.raw)
+        bytes_to_bits(scalar.raw, scalar.bytes, n);
+    else
+        str_to_bits(scalar.hex, n);
+}
+
+/*
+ * Solvers of S<width> for every width of the list, allocated the first time a scalar needs them.
+ * Solvers constructible from an integer get the one given to the dispatcher: the number of threads of
+ * WavefrontChainSolver or the window of WindowChainSolver.
+ * */
+template <template <int64_t> class S, int64_t... widths>
+class solver_set
+{
+public:
+    explicit solver_set(int64_t) {}
+    template <typename... A>
+    int64_t solve(int64_t, const scalar_ref_t &, chain_t &, const A &...) { return 0; }
+    template <typename F>
+    void backtrack(int64_t, const chain_t &, F) const {}
+};
+
+template <template <int64_t> class S, int64_t width, int64_t... rest>
+class solver_set<S, width, rest...> : private solver_set<S, rest...>
+{
+public:
+    explicit solver_set(int64_t arg) : solver_set<S, rest...>(arg), solver(NULL), arg(arg) {}
+
+    ~solver_set()
+    {
+        if(solver)
+            delete_solver(solver);
+    }
+
+    /*
+     * Solve the scalar with this width if it fits, or else with the next one, passing any other arguments
+     * (a cost model) to the solver. Returns the width used, 0 if none.
+     * */
+    template <typename... A>
+    int64_t solve(int64_t bits, const scalar_ref_t &scalar, chain_t &chain, const A &... extra)
+    {
+        bigint_t<width> n;
+        if(bits > width)
+            return solver_set<S, rest...>::solve(bits, scalar, chain, extra...);
+        if(solver == NULL && (solver = make(std::is_constructible<S<width>, int64_t>())) == NULL)
+            return 0;
+        parse_scalar(scalar, &n);
+        solver->solve(n, chain, extra...);
+        return width;
+    }
+
+    template <typename F>
+    void backtrack(int64_t used, const chain_t &chain, F term) const
+    {
+        if(used == width)
+            solver->backtrack(chain, term);
+        else
+            solver_set<S, rest...>::backtrack(used, chain, term);
+    }
+
+private:
+    S<width> *solver;
+    int64_t arg;
+
+    S<width> *make(std::true_type) { return new_solver<S<width>>(arg); }
+    S<width> *make(std::false_type) { return new_solver<S<width>>(); }
+
+    solver_set(const solver_set &);
+    solver_set &operator=(const solver_set &);
+};
+
+/*
+ * Same interface as a solver, for hexadecimal (or raw, scalar_ref_t) scalars of any size up to the largest width.
+ * A 256-bit scalar is solved by S<256> and never touches the buffers of larger widths.
+ * */
+template <template <int64_t> class S, int64_t... widths>
+class ChainDispatcher
+{
+public:
+    explicit ChainDispatcher(int64_t arg = 1) : solvers(arg), used(0) {}
+
+    /*
+     * Returns the width used, or 0 if the scalar is larger than every width (or a solver could not be allocated).
+     * Solvers that take a cost model (cost_t) get it as third argument.
+     * */
+    template <typename... A>
+    int64_t solve(const char *hex, chain_t &chain, const A &... extra)
+    {
+        return solve(hex_scalar(hex), chain, extra...);
+    }
+
+    template <typename... A>
+    int64_t solve(const scalar_ref_t &scalar, chain_t &chain, const A &... extra)
+    {
+        return used = solvers.solve(scalar_bits(scalar), scalar, chain, extra...);
+    }
+
+    /* Call term(i, j, negative) for every term of a chain found by the last call to solve() */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const
+    {
+        solvers.backtrack(used, chain, term);
+    }
+
+private:
+    solver_set<S, widths...> solvers;
+    int64_t used;
+};
+
+#endif
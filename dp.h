@@ -0,0 +1,294 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Sizes, weights, quotient plane and movements array of the 2-3 chain DP, shared by both engines
+ * (solver.h and solver_spa.h).
+ */
+#ifndef DP_H
+#define DP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include "bigint.h"
+
+/*
+ * Type of the weights of the DP. Unreachable cells start at max_size and grow by at most one per row,
+ * so weights (and weights plus one) stay below max_size + max_rows + 2. By default (WEIGHT_BITS=0)
+ * the narrowest type holding that is used; -D WEIGHT_BITS=8, 16 or 64 picks one explicitly.
+ * */
+#ifndef WEIGHT_BITS
+    #define WEIGHT_BITS 0
+#endif
+
+template <int64_t width>
+struct dp_size {
+    static const int64_t max_size = width+4;
+    /* Number of 64-bit words needed to address bits 0 to max_size */
+    static const int64_t words = bigint_t<width>::words;
+    /* Number of rows of the DP: at most floor(log_3(2^width)) + 1 non-zero quotients n/3^j plus the final zero */
+    static const int64_t max_rows = (width*631)/1000 + 2;
+    /*
+     * Number of cells of the movements array. Row j only needs cells 0 to msb[j]+2, and since
+     * msb[j] <= width - floor(j*log_2(3)) all rows together need at most this many cells.
+     * */
+    static const int64_t max_cells = max_rows*(width+4) - (1584*max_rows*(max_rows-1))/2000 + max_rows;
+    static const int64_t max_weight = max_size + max_rows + 2;
+    typedef typename std::conditional<WEIGHT_BITS == 8 || (WEIGHT_BITS == 0 && max_weight <= 255), uint8_t,
+            typename std::conditional<WEIGHT_BITS == 16 || WEIGHT_BITS == 0, uint16_t, int64_t>::type>::type weight_t;
+    static_assert(max_weight <= std::numeric_limits<weight_t>::max(), "WEIGHT_BITS too small for the bit width");
+};
+
+/*
+ * Positive (P) and negative (N) weights of one row of the DP, kept next to each other
+ * in cache-line aligned blocks.
+ * */
+template <int64_t width>
+struct weight_row_t {
+    alignas(64) typename dp_size<width>::weight_t P[dp_size<width>::max_size];
+    alignas(64) typename dp_size<width>::weight_t N[dp_size<width>::max_size];
+};
+
+/*
+ * Every quotient a = n/3^j visited by the rows of the DP, together with the two predicates that decide
+ * the vertical steps from row j to row j+1 (where b = n/3^(j+1)), packed in 64-bit words:
+ *      - bits[j]: bits a_i of a.
+ *      - vert[j]: a_i ^ b_i.
+ *      - vert_carry[j]: a_i ^ a_{i+1} ^ b_{i+1}.
+ * msb[j] is the bit length of a, and rows is the number of non-zero quotients (bits[rows] is zero).
+ * */
+template <int64_t width>
+struct plane_t {
+    uint64_t bits[dp_size<width>::max_rows][dp_size<width>::words];
+    uint64_t vert[dp_size<width>::max_rows][dp_size<width>::words];
+    uint64_t vert_carry[dp_size<width>::max_rows][dp_size<width>::words];
+    int64_t msb[dp_size<width>::max_rows];
+    int64_t rows;
+};
+
+template <int64_t width>
+using planeptr_t = plane_t<width>*;
+
+/* Both predicates of the vertical steps from the row of quotient a to the row of b = a/3, a whole word at a time */
+template <int64_t width>
+static inline void vertical_predicates(const uint64_t *a, const uint64_t *b, uint64_t *vert, uint64_t *vert_carry)
+{
+    const int64_t words = dp_size<width>::words;
+    for(int64_t k = 0; k < words; k++)
+    {
+        vert[k] = a[k] ^ b[k];
+        /* Bits i+1 of a and b moved down to position i */
+        vert_carry[k] = a[k] ^ (a[k] >> 1) ^ (b[k] >> 1);
+        if(k+1 < words)
+            vert_carry[k] ^= (a[k+1] << 63) ^ (b[k+1] << 63);
+    }
+}
+
+/*
+ * Fill the plane of n with every quotient n/3^j using the given division (divide_by_3 or divide_by_3_ct),
+ * then derive both predicates.
+ * */
+template <int64_t width>
+static inline void fill_plane(const bigint_t<width> *n, planeptr_t<width> p,
+                              void (*divide)(const bigint_t<width> *, bigintptr_t<width>))
+{
+    bigint_t<width> q[2];
+    int64_t j;
+    q[0] = *n;
+    for(j = 0; ; j++)
+    {
+        memcpy(p->bits[j], q[j & 1].num, sizeof(q[0].num));
+        p->msb[j] = q[j & 1].msb;
+        if(q[j & 1].zero) break;
+        divide(&q[j & 1], &q[(j+1) & 1]);
+    }
+    p->rows = j;
+    for(j = 0; j < p->rows; j++)
+        vertical_predicates<width>(p->bits[j], p->bits[j+1], p->vert[j], p->vert_carry[j]);
+}
+
+/*
+ * Point every row of the movements array (or of any other array with one entry per cell) at consecutive blocks
+ * of cells, as long as the plane needs them
+ * */
+template <int64_t width, typename C>
+static inline void layout_rows(const plane_t<width> *p, C *cells, C **rows)
+{
+    for(int64_t j = 0; j <= p->rows; j++)
+    {
+        rows[j] = cells;
+        cells += p->msb[j]+3;
+    }
+}
+
+/* Smallest r with r*r >= n */
+static constexpr int64_t ceil_sqrt(int64_t n, int64_t r = 1)
+{
+    return (r*r >= n) ? r: ceil_sqrt(n, r+1);
+}
+
+/* Weight of the shortest chain and the cell (i, j) of the movements array where it ends */
+typedef struct {
+    int64_t weight;
+    int64_t i;
+    int64_t j;
+} chain_t;
+
+typedef chain_t* chainptr_t;
+
+/*
+ * Backtrack from the information of the chain and the movements array T (see solver.h for its encoding),
+ * starting from the positive chain of the cell of the chain, or from its negative chain.
+ * term(i, j, negative) is called for every term +-2^i*3^j of the chain, from the largest to the smallest.
+ * T is anything where T[j] gives row j, an array of row pointers or an object that fetches rows as they are
+ * needed; rows are asked for in order of non-increasing j.
+ * */
+template <typename R, typename F>
+static inline void walk_chain(const R &T, const chain_t *chain, F term, bool negative = false)
+{
+    int64_t i = chain->i;
+    int64_t j = chain->j;
+    int64_t weight = chain->weight;
+    int8_t base = (negative) ? 4: 0;
+    bool type = T[j][i] & (1 << (base+3));
+    bool sign = T[j][i] & (1 << (base+2));
+    bool change_sign = T[j][i] & (1 << (base+1));
+    bool change_value = T[j][i] & (1 << base);
+    while(weight > 0)
+    {
+        (type) ? (j--): (i--);
+        if(change_value)
+        {
+            term(i, j, change_sign);
+            weight--;
+        }
+        (sign) ? (base = 4): (base = 0);
+        type = T[j][i] & (1 << (base+3));
+        sign = T[j][i] & (1 << (base+2));
+        change_sign = T[j][i] & (1 << (base+1));
+        change_value = T[j][i] & (1 << base);
+    }
+}
+
+/*
+ * Cost of the operations of a scalar multiplication with a chain, in any unit (tenths of a field multiplication,
+ * say). Going through the terms from the largest, d*2^a*3^b, costs a doublings and b triplings, plus one addition
+ * per other term: a mixed addition for digits +-1 (the affine input point) and a general one for the precomputed
+ * multiples of larger digits.
+ * */
+typedef struct {
+    int64_t doubling;
+    int64_t tripling;
+    int64_t mixed_addition;
+    int64_t addition;
+} cost_t;
+
+/* Every addition costs one and doublings and triplings are free: the shortest chain */
+static const cost_t term_cost = {0, 0, 1, 1};
+
+/* One term +-2^i*3^j of a chain */
+typedef struct {
+    uint16_t i;
+    uint16_t j;
+    bool negative;
+} term_t;
+
+/* A term in one word: i in bits 0 to 15, j in bits 16 to 30 and bit 31 set for negative terms */
+static inline uint32_t pack_term(int64_t i, int64_t j, bool negative)
+{
+    return (uint32_t)i | ((uint32_t)j << 16) | ((uint32_t)negative << 31);
+}
+
+static inline term_t unpack_term(uint32_t packed)
+{
+    term_t t;
+    t.i = packed & 0xffff;
+    t.j = (packed >> 16) & 0x7fff;
+    t.negative = packed >> 31;
+    return t;
+}
+
+/*
+ * Store the terms of a chain found by the last call to solver.solve() (any solver or ChainDispatcher) in
+ * terms[0] to terms[chain.weight-1], from the largest to the smallest. Returns the number of terms.
+ * */
+template <typename S>
+static inline int64_t chain_terms(const S &solver, const chain_t &chain, term_t *terms)
+{
+    int64_t count = 0;
+    solver.backtrack(chain, [&](int64_t i, int64_t j, bool negative)
+    {
+        terms[count].i = i;
+        terms[count].j = j;
+        terms[count++].negative = negative;
+    });
+    return count;
+}
+
+/* Same as chain_terms(), with one packed word per term (see pack_term()) */
+template <typename S>
+static inline int64_t chain_packed_terms(const S &solver, const chain_t &chain, uint32_t *terms)
+{
+    int64_t count = 0;
+    solver.backtrack(chain, [&](int64_t i, int64_t j, bool negative)
+    {
+        terms[count++] = pack_term(i, j, negative);
+    });
+    return count;
+}
+
+/* Adds up the cost of every term passed to it, for solvers with digits +-1 (bool) or larger ones (int64_t) */
+struct cost_counter_t {
+    const cost_t *cost;
+    int64_t *total;
+    bool *top;
+
+    void operator()(int64_t i, int64_t j, int64_t digit) const
+    {
+        if(*top)
+            *total += cost->doubling*i + cost->tripling*j;
+        else
+            *total += (digit == 1 || digit == -1) ? cost->mixed_addition: cost->addition;
+        *top = false;
+    }
+
+    void operator()(int64_t i, int64_t j, bool) const
+    {
+        (*this)(i, j, (int64_t)1);
+    }
+};
+
+/* Cost of a chain found by the last call to solver.solve(), under the cost model */
+template <typename S>
+static inline int64_t chain_cost(const S &solver, const chain_t &chain, const cost_t &cost)
+{
+    int64_t total = 0;
+    bool top = true;
+    cost_counter_t counter = {&cost, &total, &top};
+    solver.backtrack(chain, counter);
+    return total;
+}
+
+/*
+ * Solvers keep their weight rows in 64-byte aligned blocks, which plain new does not guarantee before C++17,
+ * so heap solvers come from here and go back through delete_solver().
+ * */
+template <typename S, typename... A>
+static inline S *new_solver(A... args)
+{
+    void *p;
+    if(posix_memalign(&p, 64, sizeof(S)))
+        return NULL;
+    return new(p) S(args...);
+}
+
+template <typename S>
+static inline void delete_solver(S *s)
+{
+    s->~S();
+    free(s);
+}
+
+#endif
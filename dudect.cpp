@@ -0,0 +1,241 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Timing leakage test of the SPA engine (solver_spa.h) in the style of dudect: solve() is timed in cycles on two
+ * classes of scalars, one fixed scalar and random ones, in random order, and Welch's t-test tells whether the
+ * two classes take different times.
+ * To compile: g++ dudect.cpp -o dudect -Wall -std=c++11 -O3 (-D BITS=512 for other widths, 256 by default)
+ * To run: ./dudect [-n measurements] [-s seed] [-f fixed_scalar] [-m bits] [-p] [-c file]
+ * -f gives the fixed scalar in hexadecimal (2^(BITS-1) by default) and -m the number of its leading bits shared by
+ * the random scalars (16 by default, see below). -p tests PublicSpaSolver instead, which leaks on purpose and
+ * shows that the test can see it. -c writes the class and the cycles of every measurement to 'file', one per
+ * line, for analysis elsewhere.
+ * The exit status is 1 if some |t| is above 4.5, the usual threshold of dudect, and 0 otherwise. Like any
+ * statistical test it can only find leaks, so it is a regression gate for changes of the kernels rather than
+ * a proof: run it with enough measurements and with the flags of the build that matters (-D GENERIC_KERNEL,
+ * -D WEIGHT_BITS).
+ */
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "dispatch.h"
+#include "solver_spa.h"
+
+#ifndef BITS
+    #define BITS 256
+#endif
+
+/* Threshold of |t| above which the classes are told apart, as in dudect */
+static const double t_threshold = 4.5;
+
+/* Number of cropped tests, each keeping the measurements below one percentile */
+static const int64_t crops = 10;
+
+/* Cycle counter, serialized so that only solve() is measured. Nanoseconds where there is no cycle counter */
+static inline uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned aux;
+    uint64_t t;
+    _mm_lfence();
+    t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/* Online mean and variance (Welford) of the measurements of one class */
+typedef struct {
+    double n, mean, m2;
+} moments_t;
+
+static inline void moments_push(moments_t &m, double x)
+{
+    double delta = x - m.mean;
+    m.n++;
+    m.mean += delta/m.n;
+    m.m2 += delta*(x - m.mean);
+}
+
+/* Welch's t statistic of the two classes, 0 if one of them has less than two measurements */
+static inline double welch_t(const moments_t m[2])
+{
+    if(m[0].n < 2 || m[1].n < 2)
+        return 0;
+    return (m[0].mean - m[1].mean)/sqrt(m[0].m2/(m[0].n-1)/m[0].n + m[1].m2/(m[1].n-1)/m[1].n);
+}
+
+/*
+ * The number of rows of the DP and the length of each one come from the size of n/3^j, which is public for a
+ * given bit length in the same way as the bit length itself. Random scalars that share the leading bits of the
+ * fixed one (almost always) have the same sizes, so the classes only differ in the bits the kernels work on.
+ * With 'shared' = 0 the whole scalar is random and the test also sees the number of rows.
+ * */
+static void random_scalar(std::mt19937_64 &rng, const bigint_t<BITS> &fixed, int64_t shared, bigint_t<BITS> &n)
+{
+    const int64_t words = bigint_t<BITS>::words;
+    int64_t k, low = fixed.msb - shared;
+    for(k = 0; k < words; k++)
+        n.num[k] = rng();
+    for(k = 0; k < words; k++)
+    {
+        /* Bits from 'low' on come from the fixed scalar */
+        uint64_t keep = (64*k >= low) ? ~0ULL: (64*k+64 <= low) ? 0: ~0ULL << (low - 64*k);
+        n.num[k] = (n.num[k] &~ keep) | (fixed.num[k] & keep);
+    }
+    set_msb<BITS>(&n);
+    /* Every random scalar has the bit length of the fixed one */
+    if(fixed.msb > 0)
+    {
+        n.num[(fixed.msb-1) >> 6] |= 1ULL << ((fixed.msb-1) & 63);
+        set_msb<BITS>(&n);
+    }
+}
+
+template <typename S>
+static int run_test(int64_t count, uint64_t seed, const bigint_t<BITS> &fixed, int64_t shared, FILE *dump)
+{
+    S *solver = new_solver<S>();
+    std::mt19937_64 rng(seed);
+    std::vector<bigint_t<BITS>> inputs(count);
+    std::vector<uint8_t> classes(count);
+    std::vector<uint64_t> times(count);
+    std::vector<uint64_t> sorted;
+    moments_t m[crops+1][2];
+    double t, worst = 0, percent[crops+1];
+    uint64_t limit[crops+1];
+    chain_t chain;
+    int64_t k, c;
+    if(solver == NULL)
+    {
+        fprintf(stderr, "Could not allocate the solver\n");
+        return 2;
+    }
+    /* Inputs are made before measuring, so that only solve() runs between the two readings of the counter */
+    for(k = 0; k < count; k++)
+    {
+        classes[k] = rng() & 1;
+        if(classes[k] == 0)
+            inputs[k] = fixed;
+        else
+            random_scalar(rng, fixed, shared, inputs[k]);
+    }
+    /* Warm-up */
+    for(k = 0; k < count/10 && k < 100; k++)
+        solver->solve(inputs[k], chain);
+    for(k = 0; k < count; k++)
+    {
+        uint64_t start = cycles();
+        solver->solve(inputs[k], chain);
+        times[k] = cycles() - start;
+    }
+    delete_solver(solver);
+    if(dump)
+        for(k = 0; k < count; k++)
+            fprintf(dump, "%d %" PRIu64 "\n", classes[k], times[k]);
+    /*
+     * Test 0 takes every measurement, and test c > 0 only those below the percentile 1 - 0.5^(10c/crops) of all
+     * of them (as dudect does), which drops the long tail of interrupts where a small difference would be lost
+     * */
+    sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    limit[0] = UINT64_MAX;
+    percent[0] = 100;
+    for(c = 1; c <= crops; c++)
+    {
+        percent[c] = 100*(1 - pow(0.5, 10.0*c/crops));
+        limit[c] = sorted[(int64_t)(percent[c]/100*(count-1))];
+    }
+    memset(m, 0, sizeof(m));
+    for(k = 0; k < count; k++)
+        for(c = 0; c <= crops; c++)
+            if(times[k] <= limit[c])
+                moments_push(m[c][classes[k]], times[k]);
+    printf("# %" PRId64 " measurements: %.0f fixed, %.0f random, median of %" PRIu64 " cycles\n", count,
+           m[0][0].n, m[0][1].n, sorted[count/2]);
+    for(c = 0; c <= crops; c++)
+    {
+        t = welch_t(m[c]);
+        if(fabs(t) > fabs(worst))
+            worst = t;
+        printf("# below p%-7.3f fixed %12.1f random %12.1f t %8.2f\n", percent[c], m[c][0].mean, m[c][1].mean, t);
+    }
+    printf("# max |t| = %.2f: %s\n", fabs(worst),
+           (fabs(worst) > t_threshold) ? "timing leakage detected": "no leakage detected");
+    return (fabs(worst) > t_threshold) ? 1: 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int64_t count = 10000, shared = 16, k;
+    uint64_t seed = 23;
+    const char *fixed_hex = NULL, *dump_path = NULL;
+    bool public_engine = false;
+    bigint_t<BITS> fixed;
+    std::string top;
+    FILE *dump = NULL;
+    int status;
+    for(k = 1; k < argc; k++)
+    {
+        if(strcmp(argv[k], "-p") == 0)
+            public_engine = true;
+        else if(k+1 < argc && strcmp(argv[k], "-n") == 0)
+            count = atoll(argv[++k]);
+        else if(k+1 < argc && strcmp(argv[k], "-s") == 0)
+            seed = strtoull(argv[++k], NULL, 0);
+        else if(k+1 < argc && strcmp(argv[k], "-f") == 0)
+            fixed_hex = argv[++k];
+        else if(k+1 < argc && strcmp(argv[k], "-m") == 0)
+            shared = atoll(argv[++k]);
+        else if(k+1 < argc && strcmp(argv[k], "-c") == 0)
+            dump_path = argv[++k];
+        else
+            break;
+    }
+    if(k < argc || count < 2 || shared < 0)
+    {
+        printf("\nUsage: %s [-n measurements] [-s seed] [-f fixed_scalar] [-m bits] [-p] [-c file]\n\n", argv[0]);
+        exit(1);
+    }
+    if(fixed_hex == NULL)
+    {
+        /* 2^(BITS-1) */
+        top = std::string(1, "1248"[(BITS-1) % 4]) + std::string((BITS-1)/4, '0');
+        fixed_hex = top.c_str();
+    }
+    str_to_bits(fixed_hex, &fixed);
+    if(hex_bits(fixed_hex) > BITS || fixed.zero)
+    {
+        fprintf(stderr, "The fixed scalar must be non-zero and of at most %d bits\n", BITS);
+        return 2;
+    }
+    if(shared > fixed.msb)
+        shared = fixed.msb;
+    if(dump_path && (dump = fopen(dump_path, "w")) == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", dump_path);
+        return 2;
+    }
+    printf("# %s, %d bits, fixed scalar %s, random scalars sharing its %" PRId64 " leading bits\n",
+           (public_engine) ? "PublicSpaSolver": "ConstantTimeSpaSolver", BITS, fixed_hex, shared);
+    if(public_engine)
+        status = run_test<PublicSpaSolver<BITS>>(count, seed, fixed, shared, dump);
+    else
+        status = run_test<ConstantTimeSpaSolver<BITS>>(count, seed, fixed, shared, dump);
+    if(dump)
+        fclose(dump);
+    return status;
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Scalar multiplication with a 2-3 chain on any group, and (w)NAF for comparison.
+ */
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "dp.h"
+
+/*
+ * A group backend G has a point type G::point_t and the operations
+ *      zero(r), dbl(r, a), tpl(r, a), add(r, a, c) and neg(r, a),
+ * with r = 0, 2a, 3a, a+c and -a, where r may be one of the inputs. curve.h has a reference backend.
+ *
+ * The terms of a chain come from backtrack() from the largest to the smallest, which is the order of Horner's rule:
+ * with the terms d_k*2^i_k*3^j_k, the result is computed as
+ *      (((d_1*P)*2^(i_1-i_2)*3^(j_1-j_2) + d_2*P)*2^(i_2-i_3)*3^(j_2-j_3) + ...)*2^i_last*3^j_last.
+ * So every term is evaluated as soon as backtrack() produces it, without storing the chain first.
+ * */
+template <typename G>
+class ChainExecutor
+{
+public:
+    typedef typename G::point_t point_t;
+
+    /* Precompute the multiples dP for the odd digits d up to 2*window-1 */
+    ChainExecutor(const G &group, const point_t &p, int64_t window = 1);
+
+    /* n*P for the chain of n found by the last call to solver.solve() */
+    template <typename S>
+    void multiply(const S &solver, const chain_t &chain, point_t &result);
+
+private:
+    const G &group;
+    std::vector<point_t> table, negated;
+    point_t acc, term_point;
+    int64_t i, j;
+    bool started;
+
+    void term(int64_t ti, int64_t tj, int64_t digit);
+    void shift(int64_t di, int64_t dj);
+
+    /* Term callback for backtrack(), taking digits +-1 (bool) or larger ones (int64_t) */
+    struct sink_t {
+        ChainExecutor *executor;
+
+        void operator()(int64_t i, int64_t j, int64_t digit) const
+        {
+            executor->term(i, j, digit);
+        }
+
+        void operator()(int64_t i, int64_t j, bool negative) const
+        {
+            executor->term(i, j, (negative) ? -1: 1);
+        }
+    };
+};
+
+template <typename G>
+ChainExecutor<G>::ChainExecutor(const G &group, const point_t &p, int64_t window) : group(group)
+{
+    point_t twice;
+    int64_t k;
+    table.resize((window < 1) ? 1: window);
+    negated.resize(table.size());
+    table[0] = p;
+    group.dbl(twice, p);
+    for(k = 1; k < (int64_t)table.size(); k++)
+        group.add(table[k], table[k-1], twice);
+    for(k = 0; k < (int64_t)table.size(); k++)
+        group.neg(negated[k], table[k]);
+}
+
+template <typename G>
+inline void ChainExecutor<G>::shift(int64_t di, int64_t dj)
+{
+    for(; di > 0; di--)
+        group.dbl(acc, acc);
+    for(; dj > 0; dj--)
+        group.tpl(acc, acc);
+}
+
+template <typename G>
+void ChainExecutor<G>::term(int64_t ti, int64_t tj, int64_t digit)
+{
+    const point_t &d = (digit < 0) ? negated[(-digit-1)/2]: table[(digit-1)/2];
+    if(!started)
+        acc = d;
+    else
+    {
+        shift(i-ti, j-tj);
+        group.add(acc, acc, d);
+    }
+    started = true;
+    i = ti;
+    j = tj;
+}
+
+template <typename G>
+template <typename S>
+void ChainExecutor<G>::multiply(const S &solver, const chain_t &chain, point_t &result)
+{
+    sink_t sink = {this};
+    started = false;
+    solver.backtrack(chain, sink);
+    if(!started)
+        group.zero(acc);
+    else
+        shift(i, j);
+    result = acc;
+}
+
+/*
+ * k*P + l*Q with a joint chain of (k, l) (JointChainSolver, joint.h), by Horner's rule as above. The terms are
+ * (d*P + e*Q)*2^i*3^j with d and e in {-1, 0, 1}, so the eight points +-P, +-Q, +-(P+Q) and +-(P-Q) are
+ * precomputed, and both scalars share the doublings and triplings.
+ * */
+template <typename G>
+class JointChainExecutor
+{
+public:
+    typedef typename G::point_t point_t;
+
+    JointChainExecutor(const G &group, const point_t &p, const point_t &q);
+
+    /* k*P + l*Q for the joint chain of (k, l) found by the last call to solver.solve() */
+    template <typename S>
+    void multiply(const S &solver, const chain_t &chain, point_t &result);
+
+private:
+    const G &group;
+    /* d*P + e*Q at table[3*(d+1) + e+1] */
+    point_t table[9];
+    point_t acc;
+    int64_t i, j;
+    bool started;
+
+    void term(int64_t ti, int64_t tj, int64_t d, int64_t e);
+};
+
+template <typename G>
+JointChainExecutor<G>::JointChainExecutor(const G &group, const point_t &p, const point_t &q) : group(group)
+{
+    int64_t k;
+    group.zero(table[4]);
+    table[5] = q;
+    table[7] = p;
+    group.add(table[8], p, q);
+    group.neg(table[3], q);
+    group.add(table[6], p, table[3]);
+    /* The other four are the negatives of these */
+    for(k = 0; k < 4; k++)
+        group.neg(table[k], table[8-k]);
+}
+
+template <typename G>
+void JointChainExecutor<G>::term(int64_t ti, int64_t tj, int64_t d, int64_t e)
+{
+    const point_t &t = table[3*(d+1) + e+1];
+    if(!started)
+        acc = t;
+    else
+    {
+        for(; i > ti; i--)
+            group.dbl(acc, acc);
+        for(; j > tj; j--)
+            group.tpl(acc, acc);
+        group.add(acc, acc, t);
+    }
+    started = true;
+    i = ti;
+    j = tj;
+}
+
+template <typename G>
+template <typename S>
+void JointChainExecutor<G>::multiply(const S &solver, const chain_t &chain, point_t &result)
+{
+    started = false;
+    solver.backtrack(chain, [this](int64_t ti, int64_t tj, int64_t d, int64_t e) { term(ti, tj, d, e); });
+    if(!started)
+        group.zero(acc);
+    else
+    {
+        for(; i > 0; i--)
+            group.dbl(acc, acc);
+        for(; j > 0; j--)
+            group.tpl(acc, acc);
+    }
+    result = acc;
+}
+
+/*
+ * Width-w NAF of n (w = 2 is the NAF), least significant digit first: digits odd and below 2^(w-1) in absolute
+ * value, at least w-1 zeros after each one
+ * */
+static inline void wnaf_digits(const char *hex, int64_t w, std::vector<int8_t> &digits)
+{
+    std::vector<uint64_t> k;
+    int64_t len = strlen(hex), d, q, n;
+    uint64_t digit, carry;
+    /* Words of n, least significant first */
+    k.resize(len/16+1);
+    for(q = 0; q < len; q++)
+    {
+        digit = (hex[len-1-q] > '9') ? (hex[len-1-q] &~ 0x20)-'A'+10: (hex[len-1-q]-'0');
+        k[q/16] |= (digit & 15) << (4*(q % 16));
+    }
+    digits.clear();
+    for(;;)
+    {
+        for(n = k.size(); n > 0 && k[n-1] == 0; n--);
+        if(n == 0)
+            break;
+        d = 0;
+        if(k[0] & 1)
+        {
+            d = k[0] & ((1 << w)-1);
+            if(d >= (1 << (w-1)))
+                d -= (1 << w);
+            /* k -= d, which makes k divisible by 2^w */
+            if(d > 0)
+                k[0] -= d;
+            else
+                for(q = 0, carry = -d; carry && q < (int64_t)k.size(); q++)
+                {
+                    k[q] += carry;
+                    carry = k[q] < carry;
+                }
+        }
+        digits.push_back(d);
+        for(q = 0; q < (int64_t)k.size(); q++)
+            k[q] = (k[q] >> 1) | ((q+1 < (int64_t)k.size()) ? k[q+1] << 63: 0);
+    }
+}
+
+/* n*P from the width-w NAF of n, from the top with one doubling per digit and one addition per non-zero digit */
+template <typename G>
+void wnaf_multiply(const G &group, const std::vector<int8_t> &digits, const typename G::point_t &p, int64_t w,
+                   typename G::point_t &result)
+{
+    typedef typename G::point_t point_t;
+    std::vector<point_t> table(1 << (w-2)), negated(table.size());
+    point_t twice;
+    int64_t q;
+    table[0] = p;
+    group.dbl(twice, p);
+    for(q = 1; q < (int64_t)table.size(); q++)
+        group.add(table[q], table[q-1], twice);
+    for(q = 0; q < (int64_t)table.size(); q++)
+        group.neg(negated[q], table[q]);
+    group.zero(result);
+    for(q = digits.size()-1; q >= 0; q--)
+    {
+        group.dbl(result, result);
+        if(digits[q] > 0)
+            group.add(result, result, table[(digits[q]-1)/2]);
+        else if(digits[q] < 0)
+            group.add(result, result, negated[(-digits[q]-1)/2]);
+    }
+}
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Optimal joint 2-3 chains of two scalars, for computing k*P + l*Q with one chain of doublings and triplings
+ * (Shamir's trick), as in the verification of ECDSA and Schnorr signatures.
+ */
+#ifndef JOINT_H
+#define JOINT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "dispatch.h"
+#include "dp.h"
+
+/*
+ * A joint chain of (k, l) is a sum of terms (d*P + e*Q)*2^i*3^j with digits d and e in {-1, 0, 1}, not both zero,
+ * and its weight is its number of terms: every term is one addition of one of the precomputed points +-P, +-Q,
+ * +-(P+Q) and +-(P-Q), and the doublings and triplings are shared by both scalars.
+ *
+ * The DP is that of ChainSolver (solver.h) on both scalars at once. Cell (i, j) stands for the pair (r, s) of the
+ * parts of k and l below X = 2^i*3^j, and where ChainSolver has a positive and a negative chain (of r and r-X) a
+ * cell has four: one per state (x, y) in {0, 1}^2, the shortest joint chain of (r - x*X, s - y*X). States are
+ * numbered x + 2y, and state 0 is the P chain of both scalars.
+ *
+ * As in WindowChainSolver (window.h), a horizontal step with bits a and b of the cell goes from (x, y) to
+ * (x', y') adding the term (d, e)*X with d = a+x-2x' and e = b+y-2y', and a vertical one with the digits c of
+ * both (0, 1 or 2, see solver.h) adds d = c+x-3x' (and the same for e). Every digit must be -1, 0 or 1, which
+ * leaves either one or two next states for every scalar and step, and the step costs one term unless d = e = 0.
+ *
+ * Both quotients n/3^j go through the rows together, and rows past the last non-zero quotient of the smaller
+ * scalar have a zero quotient for it. Chains end as in ChainSolver, in state 0 of the cells past the end of the
+ * longer quotient of their row. Unlike ChainSolver, the last row (where both quotients are zero) needs its
+ * horizontal steps too, as in WindowChainSolver: (1, 26) is Q*3^3 + (P - Q), whose top term is in that row.
+ * With l = 0 the chains have the weight of those of ChainSolver for k.
+ *
+ * Every cell keeps the movements of its four states in a 16-bit word, 4 bits per state: bit 3 for vertical steps
+ * and bits 0 and 1 for the previous state. The digits follow from the states and the bits of the planes, so
+ * backtrack() computes them again instead of storing them.
+ * */
+template <int64_t width>
+class JointChainSolver
+{
+public:
+    typedef bigint_t<width> scalar_t;
+
+    JointChainSolver() {}
+
+    void solve(const scalar_t &a, const scalar_t &b, chain_t &shortest);
+
+    /*
+     * Call term(i, j, d, e) for every term (d*P + e*Q)*2^i*3^j of the chain found by the last call to solve(),
+     * from the largest to the smallest
+     * */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const;
+
+private:
+    typedef typename dp_size<width>::weight_t weight_t;
+    static const int64_t max_size = dp_size<width>::max_size;
+    static const int64_t max_rows = dp_size<width>::max_rows;
+    static const int64_t max_cells = dp_size<width>::max_cells;
+    static const int64_t states = 4;
+    /* Chains have at most one term per step, so reachable weights stay below max_weight */
+    static const weight_t unreachable = (weight_t)dp_size<width>::max_weight;
+
+    /* Weights of every state of two rows */
+    weight_t weights[2][max_size][states];
+
+    /* Movements array, with row j holding cells 0 to size(j)+2 as in ChainSolver */
+    uint16_t T_cells[max_cells];
+    uint16_t *T[max_rows];
+
+    /* Quotients and vertical step predicates of both scalars, and the number of rows of the longer one */
+    plane_t<width> plane[2];
+    int64_t rows;
+
+    /* Longer quotient of row j */
+    int64_t size(int64_t j) const
+    {
+        return std::max(plane[0].msb[j], plane[1].msb[j]);
+    }
+
+    /* Digit c of the vertical step from cell (i, j) into (i, j+1) for the scalar of plane p */
+    static int64_t vertical_digit(const plane_t<width> &p, int64_t i, int64_t j)
+    {
+        return (get_bit(p.vert[j], i)) ? 1: (get_bit(p.vert_carry[j], i)) ? 2: 0;
+    }
+
+    static void extend_plane(plane_t<width> &p, int64_t rows);
+    void steps(int64_t u, int64_t v, int64_t base, int64_t s, weight_t w, weight_t *to, uint16_t &t,
+               uint16_t vertical);
+};
+
+/* Rows of the quotient zero from the end of the plane to row 'rows', for the scalar with fewer rows */
+template <int64_t width>
+void JointChainSolver<width>::extend_plane(plane_t<width> &p, int64_t rows)
+{
+    for(int64_t j = p.rows; j <= rows; j++)
+    {
+        if(j > p.rows)
+        {
+            memset(p.bits[j], 0, sizeof(p.bits[j]));
+            p.msb[j] = 0;
+        }
+        memset(p.vert[j], 0, sizeof(p.vert[j]));
+        memset(p.vert_carry[j], 0, sizeof(p.vert_carry[j]));
+    }
+}
+
+/*
+ * Steps from state s, of weight w, into the states of the cell 'to' with movements t, where u and v are the
+ * bits plus the state of each scalar, and the next state of each is (u - digit)/base
+ * */
+template <int64_t width>
+inline void JointChainSolver<width>::steps(int64_t u, int64_t v, int64_t base, int64_t s, weight_t w, weight_t *to,
+                                           uint16_t &t, uint16_t vertical)
+{
+    int64_t next, d, e;
+    weight_t weight;
+    for(next = 0; next < states; next++)
+    {
+        d = u - base*(next & 1);
+        e = v - base*(next >> 1);
+        if(d < -1 || d > 1 || e < -1 || e > 1)
+            continue;
+        weight = w + (d != 0 || e != 0);
+        if(weight < to[next])
+        {
+            to[next] = weight;
+            t &= ~(15 << (4*next));
+            t |= (vertical | s) << (4*next);
+        }
+    }
+}
+
+template <int64_t width>
+void JointChainSolver<width>::solve(const scalar_t &a, const scalar_t &b, chain_t &shortest)
+{
+    int64_t i, j, s, last, cont, u[2], c[2];
+    weight_t (*curr)[states], (*next)[states];
+    uint16_t *cells = T_cells;
+    fill_plane(&a, &plane[0], divide_by_3<width>);
+    fill_plane(&b, &plane[1], divide_by_3<width>);
+    rows = std::max(plane[0].rows, plane[1].rows);
+    extend_plane(plane[0], rows);
+    extend_plane(plane[1], rows);
+    for(j = 0; j <= rows; j++)
+    {
+        T[j] = cells;
+        cells += size(j)+3;
+    }
+    /* Zero and zero have the empty chain */
+    shortest.weight = (rows == 0) ? 0: unreachable;
+    shortest.i = shortest.j = 0;
+    for(i = 0; i <= size(0)+2; i++)
+        for(s = 0; s < states; s++)
+            weights[0][i][s] = unreachable;
+    weights[0][0][0] = 0; /* base case */
+    for(j = 0; j <= rows; j++)
+    {
+        curr = weights[j & 1];
+        next = weights[(j+1) & 1];
+        last = size(j);
+        for(i = 0; j < rows && i <= last+2; i++)
+            for(s = 0; s < states; s++)
+                next[i][s] = unreachable;
+        cont = 0;
+        for(i = 0; i <= last; i++)
+        {
+            for(s = 0; s < states && curr[i][s] >= shortest.weight; s++);
+            if(s == states)
+            {
+                cont++;
+                continue;
+            }
+            u[0] = get_bit(plane[0].bits[j], i);
+            u[1] = get_bit(plane[1].bits[j], i);
+            c[0] = (j < rows) ? vertical_digit(plane[0], i, j): 0;
+            c[1] = (j < rows) ? vertical_digit(plane[1], i, j): 0;
+            for(s = 0; s < states; s++)
+            {
+                if(curr[i][s] >= shortest.weight)
+                    continue;
+                steps(u[0] + (s & 1), u[1] + (s >> 1), 2, s, curr[i][s], curr[i+1], T[j][i+1], 0);
+                if(j < rows)
+                    steps(c[0] + (s & 1), c[1] + (s >> 1), 3, s, curr[i][s], next[i], T[j+1][i], 8);
+            }
+        }
+        /* Check if this row produced a shorter chain */
+        for(i = last+1; i <= last+2; i++)
+            if(curr[i][0] < shortest.weight)
+            {
+                shortest.weight = curr[i][0];
+                shortest.i = i;
+                shortest.j = j;
+            }
+        if(cont > last) break;
+    }
+}
+
+template <int64_t width>
+template <typename F>
+void JointChainSolver<width>::backtrack(const chain_t &chain, F term) const
+{
+    int64_t i = chain.i, j = chain.j, s = 0, from, d, e;
+    if(chain.weight == 0)
+        return;
+    /* Every chain starts from the empty chain of cell (0, 0) */
+    while(i > 0 || j > 0)
+    {
+        from = (T[j][i] >> (4*s)) & 15;
+        if(from & 8)
+        {
+            j--;
+            d = vertical_digit(plane[0], i, j) + (from & 1) - 3*(s & 1);
+            e = vertical_digit(plane[1], i, j) + ((from >> 1) & 1) - 3*(s >> 1);
+        }
+        else
+        {
+            i--;
+            d = get_bit(plane[0].bits[j], i) + (from & 1) - 2*(s & 1);
+            e = get_bit(plane[1].bits[j], i) + ((from >> 1) & 1) - 2*(s >> 1);
+        }
+        if(d != 0 || e != 0)
+            term(i, j, d, e);
+        s = from & 3;
+    }
+}
+
+/*
+ * JointChainSolver for every width of the list, as solver_set (dispatch.h) does for one scalar: a pair is solved
+ * with the smallest width that holds both scalars.
+ * */
+template <int64_t... widths>
+class joint_set
+{
+public:
+    int64_t solve(int64_t, const char *, const char *, chain_t &) { return 0; }
+    template <typename F>
+    void backtrack(int64_t, const chain_t &, F) const {}
+};
+
+template <int64_t width, int64_t... rest>
+class joint_set<width, rest...> : private joint_set<rest...>
+{
+public:
+    joint_set() : solver(NULL) {}
+
+    ~joint_set()
+    {
+        if(solver)
+            delete_solver(solver);
+    }
+
+    int64_t solve(int64_t bits, const char *a, const char *b, chain_t &chain)
+    {
+        bigint_t<width> k, l;
+        if(bits > width)
+            return joint_set<rest...>::solve(bits, a, b, chain);
+        if(solver == NULL && (solver = new_solver<JointChainSolver<width>>()) == NULL)
+            return 0;
+        str_to_bits(a, &k);
+        str_to_bits(b, &l);
+        solver->solve(k, l, chain);
+        return width;
+    }
+
+    template <typename F>
+    void backtrack(int64_t used, const chain_t &chain, F term) const
+    {
+        if(used == width)
+            solver->backtrack(chain, term);
+        else
+            joint_set<rest...>::backtrack(used, chain, term);
+    }
+
+private:
+    JointChainSolver<width> *solver;
+
+    joint_set(const joint_set &);
+    joint_set &operator=(const joint_set &);
+};
+
+/* Same as ChainDispatcher, for pairs of hexadecimal scalars */
+template <int64_t... widths>
+class JointChainDispatcher
+{
+public:
+    JointChainDispatcher() : used(0) {}
+
+    /* Returns the width used, or 0 if a scalar is larger than every width (or a solver could not be allocated) */
+    int64_t solve(const char *a, const char *b, chain_t &chain)
+    {
+        return used = solvers.solve(std::max(hex_bits(a), hex_bits(b)), a, b, chain);
+    }
+
+    /* Call term(i, j, d, e) for every term (d*P + e*Q)*2^i*3^j of a chain found by the last call to solve() */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const
+    {
+        solvers.backtrack(used, chain, term);
+    }
+
+private:
+    joint_set<widths...> solvers;
+    int64_t used;
+};
+
+#endif
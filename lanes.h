@@ -0,0 +1,497 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Optimal 2-3 chains of several scalars at once, one scalar per lane of the vectors, for the throughput of
+ * batch mode.
+ */
+#ifndef LANES_H
+#define LANES_H
+
+#include <stdint.h>
+#include <string.h>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "batch.h"
+#include "dispatch.h"
+#include "solver_spa.h"
+
+/* Scalars solved together by default: 16 weights of 16 bits fill an AVX2 vector */
+static const int64_t batch_lanes = 16;
+
+/* Vector of the weights of 'lanes' lanes, or of as many of them as fit in 'bytes' bytes */
+template <typename W, int64_t lanes, int64_t bytes = lanes*sizeof(W)>
+struct lanes_of
+{
+    typedef W type __attribute__((vector_size((lanes*sizeof(W) < bytes) ? lanes*sizeof(W): bytes)));
+};
+
+/*
+ * The DP of ConstantTimeSpaSolver (solver_spa.h) for up to 'lanes' scalars at once. Lane l of every vector holds
+ * scalar l at the same cell (i, j), so the lanes never depend on each other and a cell is one pass of vector
+ * operations: the sequential pass over the horizontal weights of the single-scalar kernels is not needed.
+ *
+ * Row j is processed up to the longest row of the lanes. The bits of n/3^j and the predicates of the vertical
+ * steps (see plane_t) come into the lanes a chunk of cells at a time, and a lane only takes the steps of the cells
+ * of its own row: the weights and movements of lanes whose row is shorter, or whose DP is over, are left as they
+ * are, so every lane takes the same steps as ConstantTimeSpaSolver and gets the same chain. The work only depends
+ * on the lengths of the rows, which the single-scalar engine does not hide either; scalars of similar lengths
+ * (run_batch sorts them) waste few lanes.
+ *
+ * The quotients are computed one row at a time, as in LowMemoryChainSolver. The weights and movements of a cell
+ * of every lane are next to each other, and the kernels go through them in vectors as wide as the instruction set
+ * (two of AVX2 or four of SSE2 for 16 lanes of 16 bits, say).
+ * */
+template <int64_t width, int64_t lanes = batch_lanes>
+class LaneChainSolver
+{
+public:
+    typedef bigint_t<width> scalar_t;
+
+    LaneChainSolver() : row_kernel(select_row_kernel()) {}
+
+    /* Shortest chains of a[0] to a[count-1] into shortest[0] to shortest[count-1], for count <= lanes */
+    void solve(const scalar_t *a, int64_t count, chain_t *shortest);
+
+    /* Call term(i, j, negative) for every term of the chain of a lane found by the last call to solve() */
+    template <typename F>
+    void backtrack(int64_t lane, const chain_t &chain, F term) const
+    {
+        lane_rows_t rows = {this, lane};
+        if(chain.weight > 0)
+            walk_chain(rows, &chain, term);
+    }
+
+private:
+    typedef typename dp_size<width>::weight_t weight_t;
+    /*
+     * Signed lanes of 16 bits or more when the weights fit, since x86 has no unsigned comparisons of 16-bit lanes
+     * before AVX-512 (8-bit lanes stay unsigned, for the movement bytes above 127)
+     * */
+    typedef typename std::make_signed<weight_t>::type signed_weight_t;
+    typedef typename std::conditional<sizeof(weight_t) >= 2 &&
+            dp_size<width>::max_weight <= std::numeric_limits<signed_weight_t>::max(), signed_weight_t,
+            weight_t>::type lane_weight_t;
+    typedef typename lanes_of<lane_weight_t, lanes, 16>::type vweight128_t;
+    typedef typename lanes_of<lane_weight_t, lanes, 32>::type vweight256_t;
+    static_assert((lanes & (lanes-1)) == 0, "The number of lanes must be a power of two");
+    static const int64_t max_size = dp_size<width>::max_size;
+    static const int64_t max_rows = dp_size<width>::max_rows;
+
+    typedef void (LaneChainSolver::*row_kernel_t)(int64_t, int64_t, int8_t, int8_t);
+
+    /* Row j of the movements of one lane, for walk_chain() */
+    struct lane_row_t {
+        const int8_t *cells;
+
+        int8_t operator[](int64_t i) const
+        {
+            return cells[i*lanes];
+        }
+    };
+
+    struct lane_rows_t {
+        const LaneChainSolver *solver;
+        int64_t lane;
+
+        lane_row_t operator[](int64_t j) const
+        {
+            lane_row_t row = {&solver->T[solver->row_start[j]*lanes + lane]};
+            return row;
+        }
+    };
+
+    /* Positive (P) and negative (N) weights of two rows, cell i of lane l at i*lanes+l */
+    alignas(64) lane_weight_t P[2][max_size*lanes];
+    alignas(64) lane_weight_t N[2][max_size*lanes];
+
+    /* Quotients n/3^j and n/3^(j+1) of every lane */
+    bigint_t<width> q[2][lanes];
+
+    /* Predicates of the vertical steps from row j of every lane, and the length of the row (0 when it has none) */
+    uint64_t vert[lanes][dp_size<width>::words];
+    uint64_t vert_carry[lanes][dp_size<width>::words];
+    alignas(64) lane_weight_t row_end[lanes];
+
+    /*
+     * Movements array, with row j holding cells 0 to size+2 of every lane from T[row_start[j]*lanes] on,
+     * where size is the longest row of the lanes. It grows to the largest batch seen and is kept.
+     * */
+    std::vector<int8_t> T;
+    int64_t row_start[max_rows+1];
+
+    /* Kernel processing one row of the DP, chosen once per solver */
+    row_kernel_t row_kernel;
+
+    static void shorter_chain(int64_t weight, int64_t i, int64_t j, chain_t &shortest);
+    template <typename V>
+    KERNEL_INLINE void row_lanes(int64_t j, int64_t size, int8_t curr, int8_t next);
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("avx2")))
+    void row_avx2(int64_t j, int64_t size, int8_t curr, int8_t next)
+    {
+        row_lanes<vweight256_t>(j, size, curr, next);
+    }
+#endif
+
+    /* 128-bit vectors: SSE2 on x86-64, NEON on AArch64 */
+    void row_simd128(int64_t j, int64_t size, int8_t curr, int8_t next)
+    {
+        row_lanes<vweight128_t>(j, size, curr, next);
+    }
+    static row_kernel_t select_row_kernel();
+
+    LaneChainSolver(const LaneChainSolver &);
+    LaneChainSolver &operator=(const LaneChainSolver &);
+};
+
+template <int64_t width, int64_t lanes>
+inline void LaneChainSolver<width, lanes>::shorter_chain(int64_t weight, int64_t i, int64_t j, chain_t &shortest)
+{
+    int64_t update = sign_mask(weight - shortest.weight);
+    shortest.weight = mask_select(update, weight, shortest.weight);
+    shortest.i = mask_select(update, i, shortest.i);
+    shortest.j = mask_select(update, j, shortest.j);
+}
+
+/*
+ * Row j of every lane, cells 0 to size, in vectors V of some of the lanes. The steps are those of
+ * SpaChainSolver::row_cells(), with the horizontal weights computed here as well. With x = (bit ? n: p),
+ * y = (bit ? p: n) + 1 and A the weight of cell i+1 of the same sign as the bit (B the other one), both cases
+ * take A = min(A, x), B = min(B, y) and then A = min(A, y).
+ * */
+template <int64_t width, int64_t lanes>
+template <typename V>
+KERNEL_INLINE void LaneChainSolver<width, lanes>::row_lanes(int64_t j, int64_t size, int8_t curr, int8_t next)
+{
+    typedef lane_ops<lane_weight_t, V> ops;
+    /* Lanes of a vector, vectors per cell and cells whose bits fit in a lane */
+    const int64_t part = ops::lanes, parts = lanes/part, chunk = 8*sizeof(lane_weight_t);
+    const bigint_t<width> *a = q[j & 1];
+    int8_t *T_row = &T[row_start[j]*lanes], *T_next = &T[row_start[j+1]*lanes];
+    lane_weight_t *P_row = P[curr], *N_row = N[curr], *P_next = P[next], *N_next = N[next];
+    alignas(64) lane_weight_t words[3][lanes];
+    V p[parts], n[parts], vp, vn, w, t, b, v, c, act, x, y, A, B, half, m, m1, m2, m3, pn, nn, tn;
+    int64_t i, k, l, h, o;
+    for(h = 0; h < parts; h++)
+    {
+        ops::load(p[h], &P_row[h*part]);
+        ops::load(n[h], &N_row[h*part]);
+    }
+    for(i = 0; i <= size; i++)
+    {
+        if(i % chunk == 0)
+            for(l = 0; l < lanes; l++)
+            {
+                words[0][l] = (lane_weight_t)get_bits(a[l].num, i, chunk);
+                words[1][l] = (lane_weight_t)get_bits(vert[l], i, chunk);
+                words[2][l] = (lane_weight_t)get_bits(vert_carry[l], i, chunk);
+            }
+        k = i % chunk;
+        for(h = 0; h < parts; h++)
+        {
+            /* Lanes h*part to h*part+part-1 of cell i+1 */
+            o = (i+1)*lanes + h*part;
+            ops::load(vp, &P_row[o]);
+            ops::load(vn, &N_row[o]);
+            ops::load_bytes(t, &T_row[o]);
+            ops::load(w, &words[0][h*part]);
+            b = -((w >> k) & 1);
+            ops::load(w, &words[1][h*part]);
+            v = -((w >> k) & 1);
+            ops::load(w, &words[2][h*part]);
+            c = -((w >> k) & 1);
+            ops::load(w, &row_end[h*part]);
+            act = ((V{} + (lane_weight_t)i) < w);
+            /* Horizontal steps: bit == 1 moves with 64, 1 and 48, bit == 0 with 0, 112 and 5 */
+            x = b ? n[h]: p[h];
+            y = (b ? p[h]: n[h]) + 1;
+            A = b ? vn: vp;
+            B = b ? vp: vn;
+            m1 = (x < A);
+            A = m1 ? x: A;
+            m2 = (y < B);
+            B = m2 ? y: B;
+            m3 = (y < A);
+            A = m3 ? y: A;
+            /* The movements of A go to the high half of the byte when the bit is 1, and those of B to the other half */
+            half = b ? (V{} + 240): (V{} + 15);
+            m = m3 ? (b ? (V{} + 48): (V{} + 5)): m1 ? (b ? (V{} + 64): (V{} + 0)): (t & half);
+            m |= m2 ? (b ? (V{} + 1): (V{} + 112)): (t & ~half);
+            ops::store_bytes(&T_row[o], act ? m: t);
+            vp = act ? (b ? B: A): vp;
+            vn = act ? (b ? A: B): vn;
+            ops::store(&P_row[o], vp);
+            ops::store(&N_row[o], vn);
+            /* Vertical steps from the same lanes of cell i. vert: (V, +, +1) and then (V, -, -1) */
+            o -= lanes;
+            m = (n[h]+1 < max_size);
+            pn = p[h]+1;
+            nn = m ? n[h]+1: (V{} + max_size);
+            t = m ? (V{} + 249): (V{} + 9);
+            /* !vert && vert_carry: (V, -, 0) and then (V, +, -1) */
+            m1 = (p[h]+1 < n[h]);
+            pn = (~v & c) ? (V{} + max_size): pn;
+            nn = (~v & c) ? (m1 ? p[h]+1: n[h]): nn;
+            t = (~v & c) ? (m1 ? (V{} + 176): (V{} + 192)): t;
+            /* !vert && !vert_carry: (V, +, 0) and then (V, -, +1) */
+            m2 = (n[h]+1 < p[h]);
+            pn = (~v & ~c) ? (m2 ? n[h]+1: p[h]): pn;
+            nn = (~v & ~c) ? (V{} + max_size): nn;
+            t = (~v & ~c) ? (m2 ? (V{} + 13): (V{} + 8)): t;
+            ops::load(m, &P_next[o]);
+            ops::store(&P_next[o], act ? pn: m);
+            ops::load(m, &N_next[o]);
+            ops::store(&N_next[o], act ? nn: m);
+            ops::load_bytes(tn, &T_next[o]);
+            ops::store_bytes(&T_next[o], act ? t: tn);
+            /* Cell i+1 is the next one */
+            p[h] = vp;
+            n[h] = vn;
+        }
+    }
+}
+
+/* AVX2 where the CPU has it. The choice depends only on the machine, never on the scalars */
+template <int64_t width, int64_t lanes>
+typename LaneChainSolver<width, lanes>::row_kernel_t LaneChainSolver<width, lanes>::select_row_kernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return &LaneChainSolver::row_avx2;
+#endif
+    return &LaneChainSolver::row_simd128;
+}
+
+template <int64_t width, int64_t lanes>
+void LaneChainSolver<width, lanes>::solve(const scalar_t *a, int64_t count, chain_t *shortest)
+{
+    int64_t i, j, l, size = 0, next_size, cells;
+    int8_t curr = 0, next = 1, aux;
+    bool done;
+    /* Lanes from count on hold zero, which has no rows */
+    for(l = 0; l < lanes; l++)
+    {
+        if(l < count)
+            q[0][l] = a[l];
+        else
+        {
+            memset(q[0][l].num, 0, sizeof(q[0][l].num));
+            set_msb<width>(&q[0][l]);
+        }
+        if(q[0][l].msb > size)
+            size = q[0][l].msb;
+    }
+    for(l = 0; l < count; l++)
+    {
+        /* Zero has the empty chain */
+        shortest[l].weight = (a[l].zero) ? 0: max_size;
+        shortest[l].i = shortest[l].j = 0;
+    }
+    /* Initialization. Row 0 is only read up to cell size+2, and every later row is written before it is read */
+    for(i = 0; i < (size+3)*lanes; i++)
+        P[0][i] = N[0][i] = max_size;
+    /* base case */
+    for(l = 0; l < lanes; l++)
+        P[0][l] = 0;
+    row_start[0] = 0;
+    for(j = 0; ; j++)
+    {
+        const bigint_t<width> *a_j = q[j & 1];
+        bigint_t<width> *b_j = q[(j+1) & 1];
+        /* Quotients and predicates of the next row */
+        next_size = 0;
+        done = true;
+        for(l = 0; l < lanes; l++)
+        {
+            row_end[l] = (a_j[l].zero) ? 0: a_j[l].msb+1;
+            if(a_j[l].zero)
+            {
+                b_j[l] = a_j[l];
+                continue;
+            }
+            done = false;
+            divide_by_3_ct(&a_j[l], &b_j[l]);
+            vertical_predicates<width>(a_j[l].num, b_j[l].num, vert[l], vert_carry[l]);
+            if(b_j[l].msb > next_size)
+                next_size = b_j[l].msb;
+        }
+        if(done)
+            break;
+        row_start[j+1] = row_start[j] + size+3;
+        cells = row_start[j+1] + next_size+3;
+        if((int64_t)T.size() < cells*lanes)
+            T.resize(cells*lanes);
+        for(l = 0; l < lanes; l++)
+            if(!a_j[l].zero)
+            {
+                P[next][(a_j[l].msb+1)*lanes + l] = N[next][(a_j[l].msb+1)*lanes + l] = max_size;
+                P[next][(a_j[l].msb+2)*lanes + l] = N[next][(a_j[l].msb+2)*lanes + l] = max_size;
+            }
+        (this->*row_kernel)(j, size, curr, next);
+        /* Check if this iteration produced a chain shorter than the shortest so far, lane by lane */
+        for(l = 0; l < count; l++)
+            if(!a_j[l].zero)
+            {
+                shorter_chain(P[curr][(a_j[l].msb+1)*lanes + l], a_j[l].msb+1, j, shortest[l]);
+                shorter_chain(P[curr][(a_j[l].msb+2)*lanes + l], a_j[l].msb+2, j, shortest[l]);
+                shorter_chain(P[next][(b_j[l].msb+1)*lanes + l], b_j[l].msb+1, j+1, shortest[l]);
+                shorter_chain(P[next][(b_j[l].msb+2)*lanes + l], b_j[l].msb+2, j+1, shortest[l]);
+            }
+        /* Next iteration */
+        size = next_size;
+        aux = curr;
+        curr = next;
+        next = aux;
+    }
+}
+
+/*
+ * LaneChainSolver<width> for every width of the list, allocated the first time a batch needs it, in the
+ * same way as solver_set (dispatch.h)
+ * */
+template <int64_t lanes, int64_t... widths>
+class lane_solver_set
+{
+public:
+    int64_t solve(int64_t, const scalar_ref_t *, int64_t, chain_t *) { return 0; }
+    template <typename F>
+    void backtrack(int64_t, int64_t, const chain_t &, F) const {}
+};
+
+template <int64_t lanes, int64_t width, int64_t... rest>
+class lane_solver_set<lanes, width, rest...> : private lane_solver_set<lanes, rest...>
+{
+public:
+    lane_solver_set() : solver(NULL) {}
+
+    ~lane_solver_set()
+    {
+        if(solver)
+            delete_solver(solver);
+    }
+
+    /* Solve the scalars with this width if the largest one (of 'bits' bits) fits, or else with the next one */
+    int64_t solve(int64_t bits, const scalar_ref_t *scalars, int64_t count, chain_t *chains)
+    {
+        bigint_t<width> n[lanes];
+        int64_t k;
+        if(bits > width)
+            return lane_solver_set<lanes, rest...>::solve(bits, scalars, count, chains);
+        if(solver == NULL && (solver = new_solver<LaneChainSolver<width, lanes>>()) == NULL)
+            return 0;
+        for(k = 0; k < count; k++)
+            parse_scalar(scalars[k], &n[k]);
+        solver->solve(n, count, chains);
+        return width;
+    }
+
+    template <typename F>
+    void backtrack(int64_t used, int64_t lane, const chain_t &chain, F term) const
+    {
+        if(used == width)
+            solver->backtrack(lane, chain, term);
+        else
+            lane_solver_set<lanes, rest...>::backtrack(used, lane, chain, term);
+    }
+
+private:
+    LaneChainSolver<width, lanes> *solver;
+
+    lane_solver_set(const lane_solver_set &);
+    lane_solver_set &operator=(const lane_solver_set &);
+};
+
+/*
+ * ChainDispatcher for up to 'lanes' scalars at once. They are all solved with the smallest width
+ * that holds the largest of them, which gives the same chains as their own widths would.
+ * */
+template <int64_t lanes, int64_t... widths>
+class LaneDispatcher
+{
+public:
+    LaneDispatcher() : used(0) {}
+
+    /* Returns the width used, or 0 if a scalar is larger than every width (or a solver could not be allocated) */
+    int64_t solve(const scalar_ref_t *scalars, int64_t count, chain_t *chains)
+    {
+        int64_t k, bits = 0;
+        for(k = 0; k < count; k++)
+            bits = std::max(bits, scalar_bits(scalars[k]));
+        return used = solvers.solve(bits, scalars, count, chains);
+    }
+
+    /* Call term(i, j, negative) for every term of the chain of a lane found by the last call to solve() */
+    template <typename F>
+    void backtrack(int64_t lane, const chain_t &chain, F term) const
+    {
+        solvers.backtrack(used, lane, chain, term);
+    }
+
+    /* Largest scalar, in bits, that can be solved */
+    static int64_t max_bits()
+    {
+        static const int64_t list[] = {widths...};
+        return list[sizeof(list)/sizeof(list[0]) - 1];
+    }
+
+private:
+    lane_solver_set<lanes, widths...> solvers;
+    int64_t used;
+};
+
+/* Batches of a LaneDispatcher are handed to the workers of run_batch 'lanes' scalars at a time */
+template <int64_t lanes, int64_t... widths>
+static inline int64_t batch_group(const LaneDispatcher<lanes, widths...> *)
+{
+    return lanes;
+}
+
+/*
+ * Same as batch_solve() for the scalars scalars[index[0]] to scalars[index[count-1]], count <= lanes: the ones that
+ * are not in the cache are solved together.
+ * */
+template <int64_t lanes, int64_t... widths>
+static void batch_solve_group(LaneDispatcher<lanes, widths...> *solver, ChainCache *cache,
+                              const std::vector<scalar_ref_t> &scalars, std::vector<std::string> &results,
+                              const int64_t *index, int64_t count, bool binary, batch_scratch_t &scratch)
+{
+    scalar_ref_t solving_scalars[lanes];
+    int64_t pending[lanes], solving = 0, used = 0, k, s;
+    chain_t chains[lanes];
+    for(k = 0; k < count; k++)
+    {
+        s = index[k];
+        batch_scalar_words(scratch.scalar, scalars[s]);
+        if(cache != NULL && cache->lookup(scratch.scalar, scratch.terms))
+            batch_format(scalars[s], scratch, true, results[s], binary);
+        else if(scalar_bits(scalars[s]) > solver->max_bits())
+            batch_format(scalars[s], scratch, false, results[s], binary);
+        else
+        {
+            solving_scalars[solving] = scalars[s];
+            pending[solving++] = s;
+        }
+    }
+    if(solving > 0)
+        used = solver->solve(solving_scalars, solving, chains);
+    for(k = 0; k < solving; k++)
+    {
+        s = pending[k];
+        batch_scalar_words(scratch.scalar, scalars[s]);
+        if(used)
+        {
+            scratch.terms.clear();
+            solver->backtrack(k, chains[k], [&](int64_t i, int64_t j, bool negative)
+            {
+                scratch.terms.push_back(pack_term(i, j, negative));
+            });
+            if(cache)
+                cache->insert(scratch.scalar, scratch.terms.data(), scratch.terms.size());
+        }
+        batch_format(scalars[s], scratch, used != 0, results[s], binary);
+    }
+}
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * lib23chains: both engines behind the C interface of lib23chains.h. Nothing is written to stdout or stderr.
+ * To build: g++ lib23chains.cpp -o lib23chains.so -shared -fPIC -fvisibility=hidden -Wall -std=c++11 -O3 -pthread
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "dispatch.h"
+#include "lib23chains.h"
+#include "solver.h"
+#include "solver_spa.h"
+
+typedef ChainDispatcher<ChainSolver, CHAIN_WIDTHS> fast_dispatcher_t;
+typedef ChainDispatcher<ConstantTimeSpaSolver, CHAIN_WIDTHS> regular_dispatcher_t;
+
+static const int64_t chain_widths[] = {CHAIN_WIDTHS};
+static const int64_t max_bits = chain_widths[sizeof(chain_widths)/sizeof(chain_widths[0]) - 1];
+
+/* Solvers of the calling thread, allocated by the dispatchers the first time a width is needed */
+typedef struct {
+    fast_dispatcher_t fast;
+    regular_dispatcher_t regular;
+} solvers_t;
+
+static thread_local solvers_t thread_solvers;
+
+static inline bool valid_scalar(const char *scalar)
+{
+    const char *c;
+    if(scalar == NULL || *scalar == 0)
+        return false;
+    for(c = scalar; *c; c++)
+        if(!((*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'f') || (*c >= 'A' && *c <= 'F')))
+            return false;
+    return true;
+}
+
+/* Chain of one scalar with a dispatcher, into terms. Returns the number of terms or an error */
+template <typename D>
+static int64_t solve_into(D &solver, const char *scalar, uint32_t *terms, size_t capacity)
+{
+    chain_t chain;
+    if(!valid_scalar(scalar) || (terms == NULL && capacity > 0))
+        return CHAINS23_INVALID_ARGUMENT;
+    if(hex_bits(scalar) > max_bits)
+        return CHAINS23_TOO_LARGE;
+    if(solver.solve(scalar, chain) == 0)
+        return CHAINS23_OUT_OF_MEMORY;
+    if((size_t)chain.weight > capacity)
+        return CHAINS23_BUFFER_TOO_SMALL;
+    return chain_packed_terms(solver, chain, terms);
+}
+
+static int64_t solve_with(solvers_t &solvers, int algorithm, const char *scalar, uint32_t *terms, size_t capacity)
+{
+    if(algorithm == CHAINS23_FAST)
+        return solve_into(solvers.fast, scalar, terms, capacity);
+    if(algorithm == CHAINS23_REGULAR)
+        return solve_into(solvers.regular, scalar, terms, capacity);
+    return CHAINS23_INVALID_ARGUMENT;
+}
+
+/* A batch of chains23_solve_batch() */
+typedef struct {
+    int algorithm;
+    const char *const *scalars;
+    size_t count;
+    uint32_t *terms;
+    size_t stride;
+    int64_t *weights;
+    std::atomic<size_t> next;
+} batch_job_t;
+
+/*
+ * Solve scalars of a batch with the solvers of the calling thread until none is left. Scalars are handed out one
+ * at a time, since their sizes (and times) can be very different.
+ * */
+static void solve_share(batch_job_t &job)
+{
+    size_t s;
+    while((s = job.next++) < job.count)
+        job.weights[s] = solve_with(thread_solvers, job.algorithm, job.scalars[s], job.terms+s*job.stride,
+                                    job.stride);
+}
+
+/*
+ * Worker threads of chains23_solve_batch(), started the first time a batch asks for them and kept until the
+ * library is unloaded, so that they and their thread_solvers are not started and allocated again on every call.
+ * The calling thread takes its share of each batch with its own thread_solvers. The workers take one batch at a
+ * time: a batch that finds them busy with another one is solved on its calling thread alone.
+ * */
+class BatchPool
+{
+public:
+    BatchPool() : generation(0), helpers(0), pending(0), job(NULL), quit(false) {}
+
+    ~BatchPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            quit = true;
+        }
+        wake.notify_all();
+        for(std::thread &worker : workers)
+            worker.join();
+    }
+
+    /* Solve the batch with up to 'threads' threads, the calling one included */
+    void run(batch_job_t &batch, int64_t threads)
+    {
+        std::unique_lock<std::mutex> owner(busy, std::try_to_lock);
+        if(owner.owns_lock() && threads > 1)
+        {
+            try
+            {
+                while((int64_t)workers.size() < threads-1)
+                    workers.emplace_back(&BatchPool::worker, this, (int64_t)workers.size());
+            }
+            catch(...)
+            {
+                /* Fewer threads than asked for, the others take their share */
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            helpers = std::min(threads-1, (int64_t)workers.size());
+            pending = helpers;
+            job = &batch;
+            generation++;
+            wake.notify_all();
+        }
+        solve_share(batch);
+        if(owner.owns_lock())
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [&]() { return pending == 0; });
+            helpers = 0;
+            job = NULL;
+        }
+    }
+
+private:
+    std::mutex busy, lock;
+    std::condition_variable wake, done;
+    std::vector<std::thread> workers;
+    int64_t generation, helpers, pending;
+    batch_job_t *job;
+    bool quit;
+
+    /* Worker 'index' takes part in the batches that ask for more than 'index' helpers */
+    void worker(int64_t index)
+    {
+        int64_t seen = 0;
+        batch_job_t *batch;
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&]() { return quit || generation != seen; });
+                if(quit)
+                    return;
+                seen = generation;
+                if(index >= helpers)
+                    continue;
+                batch = job;
+            }
+            solve_share(*batch);
+            std::lock_guard<std::mutex> guard(lock);
+            if(--pending == 0)
+                done.notify_one();
+        }
+    }
+
+    BatchPool(const BatchPool &);
+    BatchPool &operator=(const BatchPool &);
+};
+
+static BatchPool batch_pool;
+
+size_t chains23_max_terms(size_t bits)
+{
+    /* The NAF is a 2-3 chain with at most one term per two bits, plus one */
+    return bits/2 + 2;
+}
+
+size_t chains23_max_bits(void)
+{
+    return max_bits;
+}
+
+int64_t chains23_solve(int algorithm, const char *scalar, uint32_t *terms, size_t capacity)
+{
+    return solve_with(thread_solvers, algorithm, scalar, terms, capacity);
+}
+
+int64_t chains23_solve_batch(int algorithm, const char *const *scalars, size_t count, uint32_t *terms,
+                             size_t stride, int64_t *weights, int threads)
+{
+    size_t k;
+    if((scalars == NULL || weights == NULL || (terms == NULL && stride > 0)) && count > 0)
+        return CHAINS23_INVALID_ARGUMENT;
+    if(algorithm != CHAINS23_FAST && algorithm != CHAINS23_REGULAR)
+    {
+        for(k = 0; k < count; k++)
+            weights[k] = CHAINS23_INVALID_ARGUMENT;
+        return CHAINS23_INVALID_ARGUMENT;
+    }
+    if(threads <= 0)
+        threads = std::thread::hardware_concurrency();
+    if(threads <= 0)
+        threads = 1;
+    if((size_t)threads > count)
+        threads = (count > 0) ? count: 1;
+    batch_job_t job = {algorithm, scalars, count, terms, stride, weights, {0}};
+    batch_pool.run(job, threads);
+    for(k = 0; k < count; k++)
+        if(weights[k] < 0)
+            return weights[k];
+    return 0;
+}
+
+chains23_chain_t *chains23_solve_alloc(int algorithm, const char *scalar, int64_t *error)
+{
+    chains23_chain_t *chain = (chains23_chain_t *)malloc(sizeof(chains23_chain_t));
+    size_t capacity = (scalar) ? chains23_max_terms(4*strlen(scalar)): 0;
+    int64_t weight = CHAINS23_OUT_OF_MEMORY;
+    if(chain && (chain->terms = (uint32_t *)malloc(4*capacity+4)) != NULL)
+        weight = chains23_solve(algorithm, scalar, chain->terms, capacity);
+    else if(chain)
+        chain->terms = NULL;
+    if(weight < 0)
+    {
+        chains23_free_chain(chain);
+        if(error)
+            *error = weight;
+        return NULL;
+    }
+    chain->weight = weight;
+    if(error)
+        *error = 0;
+    return chain;
+}
+
+void chains23_free_chain(chains23_chain_t *chain)
+{
+    if(chain == NULL)
+        return;
+    free(chain->terms);
+    free(chain);
+}
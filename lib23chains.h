@@ -0,0 +1,78 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * C interface of lib23chains, for calling the solvers from other languages without starting a process.
+ * To build: g++ lib23chains.cpp -o lib23chains.so -shared -fPIC -fvisibility=hidden -Wall -std=c++11 -O3 -pthread
+ * (-D BITS=256, for example, builds only the 256-bit solvers, as with the programs).
+ */
+#ifndef LIB23CHAINS_H
+#define LIB23CHAINS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHAINS23_API __attribute__((visibility("default")))
+
+/*
+ * Algorithms: CHAINS23_FAST is ChainSolver (23.cpp), which prunes and takes a time that depends on the scalar;
+ * CHAINS23_REGULAR is the constant-time SPA engine (23_spa.cpp), for secret scalars.
+ * */
+#define CHAINS23_FAST 0
+#define CHAINS23_REGULAR 1
+
+/* Errors, returned as negative numbers of terms */
+#define CHAINS23_INVALID_ARGUMENT (-1) /* unknown algorithm, NULL pointer, or not a hexadecimal scalar */
+#define CHAINS23_TOO_LARGE (-2) /* larger than every width of the library */
+#define CHAINS23_BUFFER_TOO_SMALL (-3)
+#define CHAINS23_OUT_OF_MEMORY (-4)
+
+/*
+ * Chains are arrays of packed terms +-2^i*3^j, from the largest to the smallest: i in bits 0 to 15, j in bits
+ * 16 to 30 and bit 31 set for negative terms.
+ * */
+static inline uint32_t chains23_term_i(uint32_t term) { return term & 0xffff; }
+static inline uint32_t chains23_term_j(uint32_t term) { return (term >> 16) & 0x7fff; }
+static inline int chains23_term_negative(uint32_t term) { return (int)(term >> 31); }
+
+/* A chain allocated by the library, released with chains23_free_chain() */
+typedef struct {
+    int64_t weight;
+    uint32_t *terms;
+} chains23_chain_t;
+
+/* Number of terms that is enough for any chain of a scalar of 'bits' bits, to size the buffers */
+CHAINS23_API size_t chains23_max_terms(size_t bits);
+
+/* Largest scalar, in bits, that the library solves */
+CHAINS23_API size_t chains23_max_bits(void);
+
+/*
+ * Shortest chain of a scalar given in hexadecimal (without prefix), in terms[0] to terms[capacity-1].
+ * Returns the number of terms, or a negative error. Every thread has its own solvers, allocated the first time
+ * it needs each width and kept until the thread exits, so calls from different threads do not wait for each other.
+ * */
+CHAINS23_API int64_t chains23_solve(int algorithm, const char *scalar, uint32_t *terms, size_t capacity);
+
+/*
+ * Chains of 'count' scalars with 'threads' threads (0 for one per core), the calling one included. The chain of
+ * scalar k goes to terms[k*stride] and has weights[k] terms, or weights[k] is a negative error. Returns 0 if every
+ * scalar was solved, or else the error of the first one that was not. The worker threads and their solvers are
+ * kept from one call to the next; while they solve the batch of another thread, a batch is solved on its calling
+ * thread alone.
+ * */
+CHAINS23_API int64_t chains23_solve_batch(int algorithm, const char *const *scalars, size_t count, uint32_t *terms,
+                                          size_t stride, int64_t *weights, int threads);
+
+/* Same as chains23_solve(), in memory allocated by the library. Returns NULL on error, with the error in *error */
+CHAINS23_API chains23_chain_t *chains23_solve_alloc(int algorithm, const char *scalar, int64_t *error);
+
+CHAINS23_API void chains23_free_chain(chains23_chain_t *chain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Optimal 2-3 chains keeping only checkpoints of the DP instead of the whole movements array, for very large
+ * scalars or many solvers at once.
+ */
+#ifndef LOWMEM_H
+#define LOWMEM_H
+
+#include <stdint.h>
+#include <string.h>
+#include "solver.h"
+
+/*
+ * Same DP and same chains as ChainSolver (solver.h), with the rows cut in segments of segment_rows (about the
+ * square root of the number of rows). solve() runs the DP with two rows of weights and movements and, at the first
+ * row of every segment, saves a checkpoint: the weights and movements of the row after the vertical steps into it,
+ * its quotient n/3^j and the shortest chain so far, which is all the pruning looks at. The quotients are
+ * computed one row at a time as well, so there is no plane.
+ *
+ * backtrack() walks the chain from its last row up. When the walk enters a segment, the DP of the segment is run
+ * again from its checkpoint, storing its movements this time; starting from the same state it takes the same steps
+ * as the first time. Segments are entered in order, so every row is computed at most twice.
+ *
+ * Memory goes from the max_cells movements and the plane of ChainSolver, O(width^2), to O(width*sqrt(width)):
+ * at 4096 bits about 1.3 MiB instead of 9 MiB.
+ * */
+template <int64_t width>
+class LowMemoryChainSolver
+{
+public:
+    typedef bigint_t<width> scalar_t;
+
+    LowMemoryChainSolver() : last_row(-1), loaded(-1) {}
+
+    void solve(const scalar_t &a, chain_t &shortest);
+
+    /* Call term(i, j, negative) for every term of a chain found by the last call to solve() */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const
+    {
+        segment_rows_t rows = {this};
+        if(chain.weight > 0)
+            walk_chain(rows, &chain, term);
+    }
+
+private:
+    typedef typename dp_size<width>::weight_t weight_t;
+    static const int64_t max_size = dp_size<width>::max_size;
+    static const int64_t max_rows = dp_size<width>::max_rows;
+    static const int64_t segment_rows = ceil_sqrt(max_rows);
+    static const int64_t max_segments = (max_rows + segment_rows-1)/segment_rows;
+
+    typedef struct {
+        weight_row_t<width> weights;
+        int8_t T[max_size];
+        bigint_t<width> quotient;
+        chain_t shortest;
+    } checkpoint_t;
+
+    /* Rows of the movements array for walk_chain(), running the DP of a segment again when the walk enters it */
+    struct segment_rows_t {
+        const LowMemoryChainSolver *solver;
+
+        int8_t *operator[](int64_t j) const
+        {
+            return solver->segment_row(j);
+        }
+    };
+
+    checkpoint_t checkpoints[max_segments];
+
+    /* Weights of two rows and their movements, during solve() */
+    weight_row_t<width> weights[2];
+    int8_t T[2][max_size];
+
+    /* Last row processed by the DP */
+    int64_t last_row;
+
+    /*
+     * Segment whose movements are in segment_T (-1 for none), one row more than the segment for the row after
+     * the last one, which only has the vertical steps into it
+     * */
+    mutable int64_t loaded;
+    mutable weight_row_t<width> replay[2];
+    mutable int8_t segment_T[segment_rows+1][max_size];
+
+    static bool row(weight_row_t<width> &curr, weight_row_t<width> &next, int8_t *T_row, int8_t *T_next,
+                    const bigint_t<width> &a, const bigint_t<width> &b, int64_t j, chain_t &shortest);
+    int8_t *segment_row(int64_t j) const;
+};
+
+/*
+ * Row j of the DP of ChainSolver, from quotient a = n/3^j to b = n/3^(j+1), with movements into T_row (row j)
+ * and T_next (row j+1). Returns true when the DP stops after this row.
+ * */
+template <int64_t width>
+bool LowMemoryChainSolver<width>::row(weight_row_t<width> &curr, weight_row_t<width> &next, int8_t *T_row,
+                                      int8_t *T_next, const bigint_t<width> &a, const bigint_t<width> &b, int64_t j,
+                                      chain_t &shortest)
+{
+    uint64_t vert[dp_size<width>::words], vert_carry[dp_size<width>::words];
+    int64_t i, size = a.msb, cont = 0;
+    vertical_predicates<width>(a.num, b.num, vert, vert_carry);
+    next.P[size+1] = next.N[size+1] = max_size;
+    next.P[size+2] = next.N[size+2] = max_size;
+    for(i = 0; i <= size; i++)
+    {
+        if(curr.P[i] >= shortest.weight && curr.N[i] >= shortest.weight)
+        {
+            next.P[i] = next.N[i] = max_size;
+            cont++;
+        }
+        else
+        {
+            horizontal_steps(get_bit(a.num, i), curr.P[i], curr.N[i], curr.P[i+1], curr.N[i+1], T_row[i+1]);
+            vertical_steps(get_bit(vert, i), get_bit(vert_carry, i), curr.P[i], curr.N[i], next.P[i], next.N[i],
+                           T_next[i], max_size);
+        }
+    }
+    /* Check if this iteration produced a chain shorter than the shortest so far */
+    for(i = size+1; i <= size+2; i++)
+        if(curr.P[i] < shortest.weight)
+        {
+            shortest.weight = curr.P[i];
+            shortest.i = i;
+            shortest.j = j;
+        }
+    for(i = b.msb+1; i <= b.msb+2; i++)
+        if(next.P[i] < shortest.weight)
+        {
+            shortest.weight = next.P[i];
+            shortest.i = i;
+            shortest.j = j+1;
+        }
+    return cont >= size || b.zero;
+}
+
+template <int64_t width>
+void LowMemoryChainSolver<width>::solve(const scalar_t &a, chain_t &shortest)
+{
+    bigint_t<width> q[2];
+    int64_t i, j, cells;
+    /* Row 0 is only read up to cell msb+2, and every later row is written before it is read */
+    for(i = 0; i <= a.msb+2; i++)
+        weights[0].P[i] = weights[0].N[i] = max_size;
+    /* Zero has the empty chain */
+    shortest.weight = (a.zero) ? 0: max_size;
+    shortest.i = shortest.j = 0;
+    weights[0].P[0] = 0; /* base case */
+    last_row = -1;
+    loaded = -1;
+    q[0] = a;
+    for(j = 0; !q[j & 1].zero; j++)
+    {
+        divide_by_3(&q[j & 1], &q[(j+1) & 1]);
+        if(j % segment_rows == 0)
+        {
+            checkpoint_t &c = checkpoints[j/segment_rows];
+            /* Cells 0 to msb+2 are all the row has */
+            cells = q[j & 1].msb+3;
+            memcpy(c.weights.P, weights[j & 1].P, cells*sizeof(weight_t));
+            memcpy(c.weights.N, weights[j & 1].N, cells*sizeof(weight_t));
+            memcpy(c.T, T[j & 1], cells);
+            c.quotient = q[j & 1];
+            c.shortest = shortest;
+        }
+        last_row = j;
+        if(row(weights[j & 1], weights[(j+1) & 1], T[j & 1], T[(j+1) & 1], q[j & 1], q[(j+1) & 1], j, shortest))
+            break;
+    }
+}
+
+/* Row j of the movements array, after running the segment that holds it again if it is not the one loaded */
+template <int64_t width>
+int8_t *LowMemoryChainSolver<width>::segment_row(int64_t j) const
+{
+    bigint_t<width> q[2];
+    chain_t shortest;
+    int64_t s = ((j < last_row) ? j: last_row)/segment_rows, start = s*segment_rows, k;
+    if(s != loaded)
+    {
+        const checkpoint_t &c = checkpoints[s];
+        memcpy(replay[0].P, c.weights.P, (c.quotient.msb+3)*sizeof(weight_t));
+        memcpy(replay[0].N, c.weights.N, (c.quotient.msb+3)*sizeof(weight_t));
+        memcpy(segment_T[0], c.T, c.quotient.msb+3);
+        q[0] = c.quotient;
+        shortest = c.shortest;
+        for(k = 0; k < segment_rows && start+k <= last_row; k++)
+        {
+            divide_by_3(&q[k & 1], &q[(k+1) & 1]);
+            row(replay[k & 1], replay[(k+1) & 1], segment_T[k], segment_T[k+1], q[k & 1], q[(k+1) & 1], start+k,
+                shortest);
+        }
+        loaded = s;
+    }
+    return segment_T[j-start];
+}
+
+#endif
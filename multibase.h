@@ -0,0 +1,289 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Optimal 2-3-5 chains, with terms +-2^i*3^j*5^m, for curves where a quintupling costs less than the doublings and
+ * additions it replaces.
+ */
+#ifndef MULTIBASE_H
+#define MULTIBASE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "dp.h"
+
+/* Widths of the 2-3-5 programs, smallest first: the DP grows with the cube of the width. -D BITS=n keeps only n */
+#ifdef BITS
+    #define MULTIBASE_WIDTHS BITS
+#else
+    #define MULTIBASE_WIDTHS 64, 128, 256, 384, 512, 1024
+#endif
+
+/*
+ * The DP of ChainSolver (solver.h) with a third dimension. Cell (i, j, m) stands for r = n mod X, X = 2^i*3^j*5^m,
+ * and keeps the weights of the shortest chains of r (P) and r-X (N). Step by base B with the digit c of the cell,
+ * the remainder of q = n/X divided by B, goes from state k (0 for P, 1 for N) to k' adding the term t*X with
+ * t = c+k-B*k'. t must be -1, 0 or 1, so horizontal steps (B = 2, c the bit of q) and vertical ones (B = 3) are
+ * those of ChainSolver, and a step by 5 from a cell with c = 2 or 3 goes nowhere.
+ *
+ * Plane m holds the rows j of the quotients n/(3^j*5^m), and cells 0 to msb+3 of every row: steps by 3 and 5 leave
+ * at most from cell msb, landing at most 3 cells past the end of the next quotient. Chains end in state P of the
+ * cells past the end of their row. The rows of quotient zero after the last row of every plane, and the planes
+ * after the last one, only take the horizontal steps into their first cells, as the last row of JointChainSolver
+ * (joint.h).
+ *
+ * Planes go in order of m, two at a time in the weights, with steps by 5 into the next plane. Plane 0 is the DP
+ * of ChainSolver, so the shortest 2-3 chain, or one as short, is known when plane 1 starts, and from there on cells
+ * whose weights reach the shortest chain so far are pruned as in ChainSolver. No step lowers a weight, so when every
+ * cell of a plane is pruned, the planes after it are not processed.
+ *
+ * Every cell keeps the movements of both states in one byte, a nibble per state (P in the low one): bits 0 and 1
+ * for the base of the step (0 for 2, 1 for 3, 2 for 5) and bit 2 for the previous state. The digits follow from the
+ * quotients, so backtrack() computes them again. That is about 0.047*width^3 bytes: 800 KiB at 256 bits, 6 MiB at
+ * 512 and 47 MiB at 1024, kept from one scalar to the next with the quotients (2.5 MiB at 512 bits).
+ * */
+template <int64_t width>
+class MultiBaseChainSolver
+{
+public:
+    typedef bigint_t<width> scalar_t;
+
+    MultiBaseChainSolver() : last_plane(0) {}
+
+    /* The shortest chain, ending in cell (shortest.i, shortest.j) of plane last_plane */
+    void solve(const scalar_t &a, chain_t &shortest);
+
+    /*
+     * Call term(i, j, m, negative) for every term +-2^i*3^j*5^m of the chain found by the last call to solve(),
+     * from the largest to the smallest
+     * */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const;
+
+private:
+    typedef typename dp_size<width>::weight_t weight_t;
+    static const int64_t max_size = dp_size<width>::max_size;
+    static const int64_t words = dp_size<width>::words;
+    /* Chains have at most one term per step, and no path has max_weight steps */
+    static const weight_t unreachable = (weight_t)dp_size<width>::max_weight;
+
+    typedef struct {
+        int64_t msb;
+        /* First cell of the row in T */
+        int64_t start;
+    } row_t;
+
+    /* Rows of every plane, the first row of every plane and one past the last, and the quotients of the rows */
+    std::vector<row_t> rows;
+    std::vector<int64_t> planes;
+    std::vector<uint64_t> quotients;
+
+    /* Movements array, and the P and N weights of two planes */
+    std::vector<uint8_t> T;
+    std::vector<weight_t> weights[2];
+
+    /* Digits of the steps by 3 and by 5 of the row being processed */
+    uint8_t digits3[max_size], digits5[max_size];
+
+    int64_t last_plane;
+
+    /* First cell of plane m in T, or the end of T after the last plane */
+    int64_t plane_start(int64_t m) const
+    {
+        return (planes[m] < (int64_t)rows.size()) ? rows[planes[m]].start: (int64_t)T.size();
+    }
+
+    void add_row(const bigint_t<width> &q);
+    static void steps(int64_t v, int64_t base, int64_t k, weight_t w, weight_t *to, uint8_t &t, uint8_t type);
+    static int64_t digit(const uint64_t *q, int64_t msb, int64_t i, int64_t base);
+};
+
+template <int64_t width>
+void MultiBaseChainSolver<width>::add_row(const bigint_t<width> &q)
+{
+    row_t row = {q.msb, (rows.empty()) ? 0: rows.back().start + rows.back().msb+4};
+    rows.push_back(row);
+    quotients.insert(quotients.end(), q.num, q.num + words);
+}
+
+/*
+ * Steps by 'base' from state k, of weight w, into the states of the cell 'to' with movements t, where v is the
+ * digit of the cell plus k and the next state is (v - t)/base
+ * */
+template <int64_t width>
+inline void MultiBaseChainSolver<width>::steps(int64_t v, int64_t base, int64_t k, weight_t w, weight_t *to,
+                                               uint8_t &t, uint8_t type)
+{
+    int64_t next, d;
+    weight_t weight;
+    for(next = 0; next < 2; next++)
+    {
+        d = v - base*next;
+        if(d < -1 || d > 1)
+            continue;
+        weight = w + (d != 0);
+        if(weight < to[next])
+        {
+            to[next] = weight;
+            t &= ~(15 << (4*next));
+            t |= (type | k << 2) << (4*next);
+        }
+    }
+}
+
+/* (q >> i) mod base, for a quotient q of bit length msb */
+template <int64_t width>
+int64_t MultiBaseChainSolver<width>::digit(const uint64_t *q, int64_t msb, int64_t i, int64_t base)
+{
+    int64_t r = 0;
+    for(int64_t k = msb-1; k >= i; k--)
+        r = (2*r + get_bit(q, k)) % base;
+    return r;
+}
+
+template <int64_t width>
+void MultiBaseChainSolver<width>::solve(const scalar_t &a, chain_t &shortest)
+{
+    bigint_t<width> q[2], p[2];
+    int64_t i, j, k, m, count, nonzero, prev = 0, size, live, r3, r5;
+    row_t *row;
+    rows.clear();
+    planes.clear();
+    quotients.clear();
+    /* Zero has the empty chain */
+    shortest.weight = (a.zero) ? 0: unreachable;
+    shortest.i = shortest.j = 0;
+    last_plane = 0;
+    if(a.zero)
+        return;
+    /*
+     * Rows whose quotient is not zero, the row of quotient zero after them (the steps by 3 from the last one) and
+     * as many as the previous plane had non-zero ones (its steps by 5), up to the first plane of quotient zero
+     * */
+    p[0] = a;
+    for(m = 0; ; m++)
+    {
+        planes.push_back(rows.size());
+        q[0] = p[m & 1];
+        for(j = 0, nonzero = 0; !q[j & 1].zero || j == nonzero || j < prev; j++)
+        {
+            add_row(q[j & 1]);
+            if(q[j & 1].zero)
+                q[(j+1) & 1] = q[j & 1];
+            else
+            {
+                divide_by_3(&q[j & 1], &q[(j+1) & 1]);
+                nonzero++;
+            }
+        }
+        prev = nonzero;
+        if(p[m & 1].zero)
+            break;
+        divide_by_k<5>(&p[m & 1], &p[(m+1) & 1]);
+    }
+    planes.push_back(rows.size());
+    T.resize(rows.back().start + rows.back().msb+4);
+    /* Plane 0 has the most cells */
+    size = plane_start(1);
+    weights[0].resize(2*size);
+    weights[1].resize(2*size);
+    for(i = 0; i < 2*size; i++)
+        weights[0][i] = unreachable;
+    weights[0][0] = 0; /* base case */
+    for(m = 0; m+1 < (int64_t)planes.size(); m++)
+    {
+        weight_t *curr = weights[m & 1].data(), *next = weights[(m+1) & 1].data();
+        const int64_t base = plane_start(m), next_base = plane_start(m+1);
+        for(i = 0; m+2 < (int64_t)planes.size() && i < 2*(plane_start(m+2) - next_base); i++)
+            next[i] = unreachable;
+        count = planes[m+1] - planes[m];
+        live = 0;
+        for(j = 0; j < count; j++)
+        {
+            row = &rows[planes[m]+j];
+            const uint64_t *bits = &quotients[(planes[m]+j)*words];
+            weight_t *w = curr + 2*(row->start - base), *w3 = NULL, *w5 = NULL;
+            uint8_t *T3 = NULL, *T5 = NULL;
+            if(row->msb > 0)
+            {
+                /* Non-zero rows have the rows that their steps by 3 and 5 go into */
+                w3 = curr + 2*(row[1].start - base);
+                T3 = &T[row[1].start];
+                w5 = next + 2*(rows[planes[m+1]+j].start - next_base);
+                T5 = &T[rows[planes[m+1]+j].start];
+                digits3[row->msb] = digits5[row->msb] = 0;
+                for(i = row->msb-1, r3 = 0, r5 = 0; i >= 0; i--)
+                {
+                    r3 = (2*r3 + get_bit(bits, i)) % 3;
+                    r5 = (2*r5 + get_bit(bits, i)) % 5;
+                    digits3[i] = r3;
+                    digits5[i] = r5;
+                }
+            }
+            for(i = 0; i <= row->msb+2; i++)
+            {
+                if(w[2*i] >= shortest.weight && w[2*i+1] >= shortest.weight)
+                    continue;
+                live++;
+                for(k = 0; k < 2; k++)
+                {
+                    if(w[2*i+k] >= shortest.weight)
+                        continue;
+                    steps(get_bit(bits, i) + k, 2, k, w[2*i+k], &w[2*(i+1)], T[row->start+i+1], 0);
+                    if(w3 && i <= row->msb)
+                    {
+                        steps(digits3[i] + k, 3, k, w[2*i+k], &w3[2*i], T3[i], 1);
+                        steps(digits5[i] + k, 5, k, w[2*i+k], &w5[2*i], T5[i], 2);
+                    }
+                }
+            }
+            /* Check if this row produced a shorter chain */
+            for(i = row->msb+1; i <= row->msb+3; i++)
+                if(w[2*i] < shortest.weight)
+                {
+                    shortest.weight = w[2*i];
+                    shortest.i = i;
+                    shortest.j = j;
+                    last_plane = m;
+                }
+        }
+        if(live == 0)
+            break;
+    }
+}
+
+template <int64_t width>
+template <typename F>
+void MultiBaseChainSolver<width>::backtrack(const chain_t &chain, F term) const
+{
+    int64_t i = chain.i, j = chain.j, m = last_plane, s = 0, from, row, c, base, t;
+    if(chain.weight == 0)
+        return;
+    /* Every chain starts from the empty chain of cell (0, 0, 0) */
+    while(i > 0 || j > 0 || m > 0)
+    {
+        from = (T[rows[planes[m]+j].start + i] >> (4*s)) & 15;
+        if((from & 3) == 0)
+        {
+            i--;
+            row = planes[m]+j;
+            c = get_bit(&quotients[row*words], i);
+            base = 2;
+        }
+        else
+        {
+            if((from & 3) == 1)
+                j--;
+            else
+                m--;
+            row = planes[m]+j;
+            base = ((from & 3) == 1) ? 3: 5;
+            c = digit(&quotients[row*words], rows[row].msb, i, base);
+        }
+        t = c + (from >> 2) - base*s;
+        if(t != 0)
+            term(i, j, m, t < 0);
+        s = from >> 2;
+    }
+}
+
+#endif
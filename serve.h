@@ -0,0 +1,468 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Service mode: a long-running server on a Unix socket that solves the scalars of any number of clients in
+ * micro-batches, with its solvers and cache kept warm from one request to the next.
+ */
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batch.h"
+
+/*
+ * Protocol: a client connects to the socket and writes hexadecimal scalars, one per line, without waiting for the
+ * replies. Every scalar gets back its record of a chain table (chain_file.h): scalar_words, weight, the words of
+ * the scalar and its packed terms, or weight chain_unsolved when it is larger than every width. The records of a
+ * connection come in the order of its scalars, and as in batch mode blank lines and lines starting with '#' get
+ * none. A client that shuts down its side of the connection still gets the records of all its scalars.
+ *
+ * One thread polls the socket and the connections, reading the scalars into a queue and writing the replies of
+ * every connection as fast as the client takes them, so that a slow client never holds up the others. The
+ * batcher takes the queue (up to batch_block scalars) as a micro-batch as soon as it has enough scalars for every
+ * worker, 'threads' times the group of the dispatcher (16 for LaneDispatcher, lanes.h), or when its oldest scalar
+ * has waited for the deadline. The workers solve it as in run_batch() and the records go to the connections.
+ * The queue fills up again while a batch is solved, so under load the batches grow by themselves and the
+ * deadline only matters when the traffic is light.
+ *
+ * A client that writes scalars without reading its replies is held back: its connection is not read while it has
+ * more than serve_max_waiting scalars queued or being solved, or more than serve_max_output bytes of replies not
+ * yet taken, and is read again once they drain. Together with one read per connection per round of poll(), that
+ * bounds the memory any client can take.
+ * */
+
+/* Longest line accepted from a client; scalars of 4096 bits have 1024 digits */
+static const int64_t serve_max_line = 1 << 16;
+
+/* Limits of a connection above which it is not read (see above) */
+static const int64_t serve_max_waiting = 4*batch_block, serve_max_output = 1 << 22;
+
+/* Set by SIGINT and SIGTERM: the server stops, without replying to the scalars still queued */
+static volatile sig_atomic_t serve_stopped = 0;
+
+static void serve_stop(int)
+{
+    serve_stopped = 1;
+}
+
+typedef struct {
+    int fd;
+    std::string in; /* start of a line not yet complete */
+    std::string out; /* records not yet written */
+    int64_t waiting; /* scalars queued or being solved */
+    bool closed; /* the client sends no more scalars */
+} serve_connection_t;
+
+/* Whether more scalars are taken from a connection now */
+static inline bool serve_reading(const serve_connection_t &c)
+{
+    return !c.closed && c.waiting <= serve_max_waiting && (int64_t)c.out.size() <= serve_max_output;
+}
+
+typedef struct {
+    uint64_t connection;
+    std::string line;
+    std::chrono::steady_clock::time_point arrival;
+} serve_request_t;
+
+template <typename S>
+class ChainServer
+{
+public:
+    /*
+     * 'threads' workers with a dispatcher each, which solve a scalar of every multiple of 64 bits up to
+     * 'warm_bits' before taking requests, so that the first requests find their solvers allocated
+     * */
+    ChainServer(int64_t threads, ChainCache *cache, int64_t deadline_us, int64_t warm_bits) :
+        threads(threads), cache(cache), deadline(deadline_us), warm_bits(warm_bits), stop(false), generation(0),
+        pending(0), count(0), next(0), quit(false), connections_seen(0), scalars(0), batches(0) {}
+
+    /* Serve the clients of the socket 'listener' until SIGINT or SIGTERM. Returns 0, or -1 on failure */
+    int run(int listener);
+
+    int64_t solved() const { return scalars; }
+    int64_t micro_batches() const { return batches; }
+
+private:
+    int64_t threads;
+    ChainCache *cache;
+    std::chrono::microseconds deadline;
+    int64_t warm_bits;
+
+    /* Queue and connections, shared by the poll thread and the batcher */
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<serve_request_t> queue;
+    std::map<uint64_t, serve_connection_t> connections;
+    bool stop;
+    int wake_pipe[2];
+
+    /* Workers and the batch they solve, as in run_batch() */
+    std::vector<S *> solvers;
+    std::vector<std::thread> pool;
+    std::mutex pool_lock;
+    std::condition_variable wake, done;
+    int64_t generation, pending, count, group;
+    std::atomic<int64_t> next;
+    bool quit;
+    std::vector<std::string> lines, results;
+    std::vector<scalar_ref_t> scalars_in;
+    std::vector<uint64_t> owners;
+    std::vector<int64_t> order;
+
+    uint64_t connections_seen;
+    int64_t scalars, batches;
+
+    void worker(int64_t t);
+    void batcher();
+    bool take_lines(serve_connection_t &c, uint64_t id);
+    void drop(uint64_t id);
+};
+
+template <typename S>
+void ChainServer<S>::worker(int64_t t)
+{
+    int64_t seen = 0, size, i;
+    batch_scratch_t scratch;
+    std::vector<std::string> warm, replies;
+    std::vector<scalar_ref_t> warm_scalars;
+    std::vector<int64_t> index;
+    for(int64_t bits = 64; bits <= warm_bits; bits += 64)
+        warm.push_back(std::string(bits/4, 'f'));
+    replies.resize(warm.size());
+    for(i = 0; i < (int64_t)warm.size(); i++)
+    {
+        warm_scalars.push_back(hex_scalar(warm[i].c_str()));
+        index.push_back(i);
+    }
+    for(i = 0; i < (int64_t)warm.size(); i += group)
+        batch_solve_group(solvers[t], (ChainCache *)NULL, warm_scalars, replies, &index[i],
+                          std::min(group, (int64_t)warm.size()-i), true, scratch);
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(pool_lock);
+            wake.wait(guard, [&]() { return quit || generation != seen; });
+            if(quit) return;
+            seen = generation;
+            size = count;
+        }
+        for(i = next.fetch_add(group); i < size; i = next.fetch_add(group))
+            batch_solve_group(solvers[t], cache, scalars_in, results, &order[i], std::min(group, size-i), true,
+                              scratch);
+        std::lock_guard<std::mutex> guard(pool_lock);
+        if(--pending == 0)
+            done.notify_one();
+    }
+}
+
+/* Take micro-batches from the queue, solve them and hand the records to their connections */
+template <typename S>
+void ChainServer<S>::batcher()
+{
+    int64_t fill = threads*group, k;
+    char byte = 0;
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while(!stop && (queue.empty() ||
+                  ((int64_t)queue.size() < fill && std::chrono::steady_clock::now() < queue.front().arrival+deadline)))
+            {
+                if(queue.empty())
+                    ready.wait(guard);
+                else
+                    ready.wait_until(guard, queue.front().arrival+deadline);
+            }
+            if(stop)
+                return;
+            for(count = 0; count < (int64_t)lines.size() && !queue.empty(); count++)
+            {
+                lines[count].swap(queue.front().line);
+                scalars_in[count] = hex_scalar(lines[count].c_str());
+                owners[count] = queue.front().connection;
+                queue.pop_front();
+            }
+        }
+        batch_order(scalars_in, count, group, order);
+        {
+            std::lock_guard<std::mutex> guard(pool_lock);
+            next = 0;
+            pending = threads;
+            generation++;
+        }
+        wake.notify_all();
+        {
+            std::unique_lock<std::mutex> guard(pool_lock);
+            done.wait(guard, [&]() { return pending == 0; });
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for(k = 0; k < count; k++)
+            {
+                auto found = connections.find(owners[k]);
+                if(found == connections.end())
+                    continue;
+                found->second.out += results[k];
+                found->second.waiting--;
+            }
+            scalars += count;
+            batches++;
+        }
+        /* The poll thread writes the records */
+        if(write(wake_pipe[1], &byte, 1) < 0) {}
+    }
+}
+
+/*
+ * Queue the complete lines read from a connection, and the last one when the client has closed its side.
+ * Returns false when a line is too long.
+ * */
+template <typename S>
+bool ChainServer<S>::take_lines(serve_connection_t &c, uint64_t id)
+{
+    size_t start = 0, stop_at, len;
+    auto now = std::chrono::steady_clock::now();
+    for(;;)
+    {
+        stop_at = c.in.find('\n', start);
+        if(stop_at == std::string::npos && !(c.closed && start < c.in.size()))
+            break;
+        len = ((stop_at == std::string::npos) ? c.in.size(): stop_at) - start;
+        while(len > 0 && batch_space(c.in[start+len-1]))
+            len--;
+        if(len > 0 && c.in[start] != '#')
+        {
+            queue.push_back({id, c.in.substr(start, len), now});
+            c.waiting++;
+        }
+        start = (stop_at == std::string::npos) ? c.in.size(): stop_at+1;
+    }
+    c.in.erase(0, start);
+    return (int64_t)c.in.size() <= serve_max_line;
+}
+
+template <typename S>
+void ChainServer<S>::drop(uint64_t id)
+{
+    close(connections[id].fd);
+    connections.erase(id);
+}
+
+template <typename S>
+int ChainServer<S>::run(int listener)
+{
+    std::vector<struct pollfd> fds;
+    std::vector<uint64_t> ids;
+    std::thread batch_thread;
+    char buf[65536];
+    ssize_t got;
+    size_t k;
+    int fd, t;
+    bool failed = false, queued;
+    if(pipe(wake_pipe) != 0)
+        return -1;
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+    solvers.resize(threads);
+    for(t = 0; t < threads; t++)
+        failed |= (solvers[t] = new_solver<S>()) == NULL;
+    group = (failed) ? 1: batch_group(solvers[0]);
+    lines.resize(std::max(batch_block, group));
+    results.resize(lines.size());
+    scalars_in.resize(lines.size());
+    owners.resize(lines.size());
+    for(t = 0; t < threads && !failed; t++)
+        pool.emplace_back([this, t]() { worker(t); });
+    if(!failed)
+        batch_thread = std::thread([this]() { batcher(); });
+    while(!failed && !serve_stopped)
+    {
+        fds.clear();
+        ids.clear();
+        fds.push_back({listener, POLLIN, 0});
+        fds.push_back({wake_pipe[0], POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            /*
+             * Connections with nothing to read or write are left out, or their hangup would wake poll(). Those held
+             * back come back when the batcher or the writes below drain them, each of which ends this round.
+             * */
+            for(auto &c : connections)
+            {
+                short events = ((serve_reading(c.second)) ? POLLIN: 0) | ((c.second.out.empty()) ? 0: POLLOUT);
+                fds.push_back({(events) ? c.second.fd: -1, events, 0});
+                ids.push_back(c.first);
+            }
+        }
+        /* The timeout only bounds the time to notice a signal delivered to another thread */
+        if(poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR)
+            break;
+        while(read(wake_pipe[0], buf, sizeof(buf)) > 0);
+        std::lock_guard<std::mutex> guard(lock);
+        queued = false;
+        while((fds[0].revents & POLLIN) && (fd = accept(listener, NULL, NULL)) >= 0)
+        {
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            connections[connections_seen++] = {fd, std::string(), std::string(), 0, false};
+        }
+        for(k = 2; k < fds.size(); k++)
+        {
+            serve_connection_t &c = connections[ids[k-2]];
+            if((fds[k].revents & (POLLIN | POLLHUP | POLLERR)) && serve_reading(c))
+            {
+                got = read(c.fd, buf, sizeof(buf));
+                if(got > 0)
+                    c.in.append(buf, got);
+                else if(got == 0)
+                    c.closed = true;
+                else if(errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    drop(ids[k-2]);
+                    continue;
+                }
+                queued = true;
+                if(!take_lines(c, ids[k-2]))
+                {
+                    fprintf(stderr, "# Connection %" PRIu64 " dropped: line too long\n", ids[k-2]);
+                    drop(ids[k-2]);
+                    continue;
+                }
+            }
+            if(!c.out.empty())
+            {
+                got = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+                if(got > 0)
+                    c.out.erase(0, got);
+                else if(got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    drop(ids[k-2]);
+                    continue;
+                }
+            }
+            if(c.closed && c.waiting == 0 && c.out.empty())
+                drop(ids[k-2]);
+        }
+        if(queued)
+            ready.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+        for(auto &c : connections)
+            close(c.second.fd);
+        connections.clear();
+    }
+    ready.notify_one();
+    if(batch_thread.joinable())
+        batch_thread.join();
+    {
+        std::lock_guard<std::mutex> guard(pool_lock);
+        quit = true;
+    }
+    wake.notify_all();
+    for(auto &worker : pool)
+        worker.join();
+    for(t = 0; t < threads; t++)
+        if(solvers[t])
+            delete_solver(solvers[t]);
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    return (failed) ? -1: 0;
+}
+
+/*
+ * Command line of service mode: -u [-t threads] [-c entries] [-l table] [-s table] [-d microseconds] [-w bits]
+ * socket. -c, -l and -s are the cache options of batch mode (batch_main()), with -s saving the cache when the
+ * server stops. -d is the deadline of the micro-batches, 1000 microseconds by default, and -w warms the solvers
+ * up to that many bits.
+ * */
+template <typename S>
+static int serve_main(int argc, char *argv[])
+{
+    int64_t threads = std::thread::hardware_concurrency(), entries = 0, deadline = 1000, warm_bits = 0;
+    const char *path, *warm = NULL, *save = NULL;
+    struct sockaddr_un address;
+    struct sigaction action;
+    struct stat st;
+    ChainCache *cache;
+    int listener, k = 2, status;
+    while(k+1 < argc && argv[k][0] == '-' && argv[k][1] != 0 && argv[k][2] == 0 && strchr("tclsdw", argv[k][1]))
+    {
+        switch(argv[k][1])
+        {
+        case 't': threads = atoi(argv[k+1]); break;
+        case 'c': entries = atoll(argv[k+1]); break;
+        case 'l': warm = argv[k+1]; break;
+        case 's': save = argv[k+1]; break;
+        case 'd': deadline = atoll(argv[k+1]); break;
+        case 'w': warm_bits = atoll(argv[k+1]); break;
+        }
+        k += 2;
+    }
+    if(threads < 1)
+        threads = 1;
+    if(k+1 != argc || strlen(argv[k]) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Service mode needs the path of its socket, as the last argument\n");
+        return 1;
+    }
+    path = argv[k];
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    /* A socket left by a server that did not stop cleanly is replaced, anything else at the path is not */
+    if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    if((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+       bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 128) != 0)
+    {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        if(listener >= 0)
+            close(listener);
+        return 1;
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = serve_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    cache = batch_open_cache(entries, warm, save);
+    fprintf(stderr, "# Listening on %s, %" PRIu64 " threads, deadline of %" PRIu64 " microseg\n", path, threads,
+            deadline);
+    ChainServer<S> *server = new ChainServer<S>(threads, cache, deadline, warm_bits);
+    status = server->run(listener);
+    close(listener);
+    unlink(path);
+    if(status != 0)
+        fprintf(stderr, "Cannot allocate %" PRIu64 " solvers\n", threads);
+    else
+        fprintf(stderr, "# %" PRIu64 " scalars in %" PRIu64 " micro-batches\n", server->solved(),
+                server->micro_batches());
+    delete server;
+    batch_save_cache(cache, save);
+    delete cache;
+    return (status != 0) ? 1: 0;
+}
+
+#endif
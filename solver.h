@@ -0,0 +1,338 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Optimal 2-3 chains, pruning the cells and rows that can no longer beat the shortest chain found so far.
+ */
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <stdint.h>
+#include <algorithm>
+#include "dp.h"
+#include "stats.h"
+
+/*
+ * Horizontal steps from a cell with weights p and n into the next cell of its row, with weights P and N and
+ * movements t, depending on the bit of the cell.
+ * */
+template <typename W>
+static inline void horizontal_steps(bool bit, W p, W n, W &P, W &N, int8_t &t)
+{
+    if(bit)
+    {
+        if(n < N) /* (H, -, 0) */
+        {
+            N = n;
+            t &= 15;
+            t |= 64; /* 0100 */
+        }
+        if(p+1 < P) /* (H, +, +1) */
+        {
+            P = p+1;
+            t &= 240;
+            t |= 1; /* 0001 */
+        }
+        if(p+1 < N) /* (H, +, -1) */
+        {
+            N = p+1;
+            t &= 15;
+            t |= 48; /* 0011 */
+        }
+    }
+    else /* bit == 0 */
+    {
+        if(p < P) /* (H, +, 0) */
+        {
+            P = p;
+            t &= 240;
+        }
+        if(n+1 < N) /* (H, -, -1) */
+        {
+            N = n+1;
+            t &= 15;
+            t |= 112; /* 0111 */
+        }
+        if(n+1 < P) /* (H, -, +1) */
+        {
+            P = n+1;
+            t &= 240;
+            t |= 5; /* 0101 */
+        }
+    }
+}
+
+/*
+ * Vertical steps from a cell with weights p and n into the cell below it in the next row, which gets
+ * its first weights P and N and movements t.
+ * */
+template <typename W>
+static inline void vertical_steps(bool vert, bool vert_carry, W p, W n, W &P, W &N, int8_t &t, int64_t max_size)
+{
+    if(vert)
+    {
+        P = p+1;
+        N = n+1;
+        t = 249; /* 1111 and 1001 */
+    }
+    else
+    {
+        if(vert_carry)
+        {
+            P = max_size;
+            N = p+1;
+            t = 176; /* 1011 and 0000 */
+            if(n < N) /* (V, -, 0) */
+            {
+                N = n;
+                t &= 15;
+                t |= 192; /* 1100 */
+            }
+        }
+        else
+        {
+            N = max_size;
+            P = p;
+            t = 8; /* 0000 and 1000 */
+            if(n+1 < P) /* (V, -, +1) */
+            {
+                P = n+1;
+                t &= 240;
+                t |= 13; /* 1101 */
+            }
+        }
+    }
+}
+
+/*
+ * All the state of one computation lives in the solver, so solvers on different threads are independent and a
+ * solver can be reused for any number of scalars without reallocating. The buffers are sized for 'width' bits
+ * and are large (hundreds of KiB at 1024 bits), so solvers belong in static or heap storage rather than the stack.
+ * */
+template <int64_t width>
+class ChainSolver
+{
+public:
+    typedef bigint_t<width> scalar_t;
+
+    /*
+     * Nothing is initialized here: solve() sets up what it reads, so new_solver() does not have to clear
+     * megabytes of buffers (value-initializing a class without a constructor would zero them)
+     * */
+    ChainSolver() {}
+
+    void solve(const scalar_t &a, chain_t &shortest)
+    {
+        run<false>(a, shortest, term_cost);
+    }
+
+    /*
+     * Chain of least cost under the cost model (see cost_t in dp.h) instead of the shortest one. Every term
+     * is +-1 here, so all additions are mixed ones.
+     * */
+    void solve(const scalar_t &a, chain_t &shortest, const cost_t &cost)
+    {
+        run<true>(a, shortest, cost);
+    }
+
+    /* Call term(i, j, negative) for every term of a chain found by the last call to solve() */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const
+    {
+        chain_t rest = chain;
+        if(top_state < 0 || chain.weight == 0)
+        {
+            walk_chain(T, &chain, term);
+            return;
+        }
+        /* The chain of the cell (positive or negative) below the top term */
+        term(chain.i, chain.j, false);
+        rest.weight--;
+        walk_chain(T, &rest, term, top_state == 1);
+    }
+
+private:
+    static const int64_t max_size = dp_size<width>::max_size;
+    static const int64_t max_rows = dp_size<width>::max_rows;
+    static const int64_t max_cells = dp_size<width>::max_cells;
+
+    /*
+     * Weights of positive (P) and negative (N) chains.
+     * We just need two rows of information for previous and current chains.
+     * */
+    weight_row_t<width> weights[2];
+
+    /*
+     * 'Movements array' for storing information for every chain.
+     * Every term needs 4 bits of information:
+     *      - 1 bit to know whether we did a doubling (0) or tripling (1) to get here (horizontal or vertical step).
+     *      - 1 bit to know whether the previous chain was positive (0) or negative (1).
+     *      - 2 bits to know if we got here by doing nothing (00), adding a term (01) or substracting a term (11).
+     *
+     * For example, if we got to some chain by making a vertical step (tripling) from a negative chain and we added
+     * a negative term, that means $n_{i,j} = \overline{\mathscr{C}}_{i,j-1} - 2^{i}3^{j-1}$. In this code, this will
+     * be denoted as (V, -, -1).
+     *
+     * int8_t provides 8 bits, so we use the first half of bits for storing information of positive chains
+     * and last 4 bits for storing information of negative chains.
+     *
+     * Example: We zero first half of bits and then store a movement of the type (H, +, -1) which translates to
+     * setting bits 0011:
+     *
+     * T[j][i+1] &= ~(15 << 0);
+     * T[j][i+1] |= (3 << 0);
+     *
+     * Example: We zero second half of bits and then store a movement of the type (V, -, -1) which translates to
+     * settings bits 1111:
+     *
+     * T[j+1][i] &= ~(15 << 4);
+     * T[j+1][i] |= (15 << 4);
+     *
+     * Only cells with 2^i*3^j <= n are reachable, so the rows are stored one after the other in T_cells
+     * and row j only holds its cells 0 to plane.msb[j]+2. T[j] points to the start of row j.
+     *
+     * */
+    int8_t T_cells[max_cells];
+    int8_t *T[max_rows];
+
+    /* Quotients n/3^j and vertical step predicates for every row, computed before the DP */
+    plane_t<width> plane;
+
+    /*
+     * With a cost model the chain is given by the cell of its top term and the state (0 for P, 1 for N) of the
+     * chain below it, and -1 without one, where it is given by the cell where it ends.
+     * */
+    int64_t top_state;
+
+    template <bool costed>
+    void run(const scalar_t &a, chain_t &shortest, const cost_t &cost);
+    void top_candidates(const weight_row_t<width> &row, int64_t size, int64_t j, const cost_t &cost,
+                        chain_t &shortest, int64_t &best);
+};
+
+/*
+ * With a cost model, a chain of n through cell (i, j) costs at least the additions of the terms so far and i
+ * doublings and j triplings, so cells are pruned against that bound. Its top term is +2^i*3^j after the positive
+ * chain of the cell where n/2^i*3^j = 1 (i = msb-1), or after the negative chain of the cells where
+ * n/2^i*3^j = 0 (i >= msb), and these are the candidates of every row, instead of the cells where chains end.
+ * */
+/* Top terms of row j, after the positive chain for i = size-1 and after the negative chain for i >= size */
+template <int64_t width>
+void ChainSolver<width>::top_candidates(const weight_row_t<width> &row, int64_t size, int64_t j, const cost_t &cost,
+                                        chain_t &shortest, int64_t &best)
+{
+    int64_t i, weight, total;
+    for(i = (size > 0) ? size-1: 0; i <= size+2; i++)
+    {
+        weight = (i < size) ? row.P[i]: row.N[i];
+        total = cost.mixed_addition*weight + cost.doubling*i + cost.tripling*j;
+        if(weight < max_size && total < best)
+        {
+            best = total;
+            shortest.weight = weight+1;
+            shortest.i = i;
+            shortest.j = j;
+            top_state = (i >= size);
+        }
+    }
+}
+
+template <int64_t width>
+template <bool costed>
+void ChainSolver<width>::run(const scalar_t &a, chain_t &shortest, const cost_t &cost)
+{
+    int64_t i, j, size, cont, best, bound, visited = 0, pruned = 0;
+    uint64_t clock = stats_clock();
+    int8_t curr, next, aux;
+    const uint64_t *bits, *vert, *vert_carry;
+    /* Initialization. Row 0 is only read up to cell msb+2, and every later row is written before it is read */
+    for(i = 0; i <= a.msb+2; i++)
+        weights[0].P[i] = weights[0].N[i] = max_size;
+    /* Zero has the empty chain */
+    shortest.weight = (a.zero) ? 0: max_size;
+    shortest.i = shortest.j = 0;
+    best = (a.zero) ? 0: std::numeric_limits<int64_t>::max();
+    top_state = (costed) ? 0: -1;
+    weights[0].P[0] = 0; /* base case */
+    curr = 0;
+    next = 1;
+    fill_plane(&a, &plane, divide_by_3<width>);
+    clock = stats_lap(stats_divide, clock);
+    layout_rows(&plane, T_cells, T);
+    for(j = 0; j < plane.rows; j++)
+    {
+        bits = plane.bits[j];
+        vert = plane.vert[j];
+        vert_carry = plane.vert_carry[j];
+        cont = 0;
+        size = plane.msb[j];
+        weights[next].P[size+1] = weights[next].N[size+1] = max_size;
+        weights[next].P[size+2] = weights[next].N[size+2] = max_size;
+        for(i = 0; i <= size; i++)
+        {
+            /* We don't need to check all the cases if weights of both positive and negative chains
+             * are equal or greater than the shortest chain found so far */
+            bound = cost.mixed_addition*std::min(weights[curr].P[i], weights[curr].N[i]) + cost.doubling*i +
+                    cost.tripling*j;
+            if((costed) ? bound >= best: weights[curr].P[i] >= shortest.weight && weights[curr].N[i] >= shortest.weight)
+            {
+                weights[next].P[i] = weights[next].N[i] = max_size;
+                cont++;
+            }
+            else
+            {
+                horizontal_steps(get_bit(bits, i), weights[curr].P[i], weights[curr].N[i],
+                                 weights[curr].P[i+1], weights[curr].N[i+1], T[j][i+1]);
+                vertical_steps(get_bit(vert, i), get_bit(vert_carry, i), weights[curr].P[i], weights[curr].N[i],
+                               weights[next].P[i], weights[next].N[i], T[j+1][i], max_size);
+            }
+        }
+        visited += size+1-cont;
+        pruned += cont;
+        if(costed)
+        {
+            /* The last row, of quotient zero, is only reached by vertical steps */
+            top_candidates(weights[curr], size, j, cost, shortest, best);
+            if(j+1 == plane.rows)
+                top_candidates(weights[next], 0, j+1, cost, shortest, best);
+            if(cont > size) break;
+            aux = curr;
+            curr = next;
+            next = aux;
+            continue;
+        }
+        /* Check if this iteration produced a chain shorter than the shortest so far */
+        if(weights[curr].P[size+1] < shortest.weight)
+        {
+            shortest.weight = weights[curr].P[size+1];
+            shortest.i = size+1;
+            shortest.j = j;
+        }
+        if(weights[curr].P[size+2] < shortest.weight)
+        {
+            shortest.weight = weights[curr].P[size+2];
+            shortest.i = size+2;
+            shortest.j = j;
+        }
+        size = plane.msb[j+1];
+        if(weights[next].P[size+1] < shortest.weight)
+        {
+            shortest.weight = weights[next].P[size+1];
+            shortest.i = size+1;
+            shortest.j = j+1;
+        }
+        if(weights[next].P[size+2] < shortest.weight)
+        {
+            shortest.weight = weights[next].P[size+2];
+            shortest.i = size+2;
+            shortest.j = j+1;
+        }
+        if(cont >= plane.msb[j]) break;
+        aux = curr;
+        curr = next;
+        next = aux;
+    }
+    /* j is the last row processed, or plane.rows if the DP went through all of them */
+    stats_record(plane, std::min(j+1, plane.rows), visited, pruned, shortest);
+    stats_lap(stats_dp, clock);
+}
+
+#endif
@@ -0,0 +1,456 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Optimal 2-3 chains with a regular sequence of operations: every cell of every row is processed whatever the scalar,
+ * to avoid leaking it through simple power analysis (SPA).
+ */
+#ifndef SOLVER_SPA_H
+#define SOLVER_SPA_H
+
+#include <stdint.h>
+#include <string.h>
+#include "dp.h"
+
+#define KERNEL_INLINE inline __attribute__((always_inline))
+
+/* Up to 64 consecutive bits of an array of words, starting at the i-th */
+static inline uint64_t get_bits(const uint64_t *w, int64_t i, int64_t count)
+{
+    uint64_t lo = w[i >> 6] >> (i & 63);
+    return ((i & 63) + count > 64) ? lo | (w[(i >> 6) + 1] << (64 - (i & 63))): lo;
+}
+
+/* a if mask is all ones, b if mask is zero */
+template <typename W>
+static inline W mask_select(W mask, W a, W b)
+{
+    return (a & mask) | (b & ~mask);
+}
+
+/* Minimum of a and b, with the mask coming from the comparison instead of a branch */
+template <typename W>
+static inline W mask_min(W a, W b)
+{
+    return mask_select<W>(-(W)(a < b), a, b);
+}
+
+/* All ones if d is negative and zero otherwise, from the sign bit of d */
+static inline int64_t sign_mask(int64_t d)
+{
+    return -(int64_t)((uint64_t)d >> 63);
+}
+
+/* Loads and stores of 'lanes' weights or movement bytes, and packed bits expanded into masks (all ones for 1) */
+template <int64_t lanes>
+struct bytes_of
+{
+    typedef uint8_t type __attribute__((vector_size(lanes)));
+};
+
+template <typename W, typename V>
+struct lane_ops
+{
+    static const int64_t lanes = sizeof(V)/sizeof(W);
+    typedef typename bytes_of<lanes>::type bytes_t;
+    static KERNEL_INLINE void load(V &v, const W *src) { memcpy(&v, src, sizeof(v)); }
+    static KERNEL_INLINE void store(W *dst, const V &v) { memcpy(dst, &v, sizeof(v)); }
+    static KERNEL_INLINE void load_bytes(V &v, const int8_t *src)
+    {
+        bytes_t b;
+        memcpy(&b, src, sizeof(b));
+        v = __builtin_convertvector(b, V);
+    }
+    static KERNEL_INLINE void store_bytes(int8_t *dst, const V &v)
+    {
+        bytes_t b = __builtin_convertvector(v, bytes_t);
+        memcpy(dst, &b, sizeof(b));
+    }
+    static KERNEL_INLINE void mask(V &v, const uint64_t *w, int64_t i)
+    {
+        /* Lane l takes byte l/8 of the bits and then its bit l%8, which works for any width of the weights */
+        uint64_t x = get_bits(w, i, lanes);
+        bytes_t b = {}, sel, shift;
+        for(int64_t l = 0; l < lanes; l++)
+        {
+            sel[l] = l >> 3;
+            shift[l] = l & 7;
+        }
+        memcpy(&b, &x, (lanes < 8) ? lanes: 8);
+        b = (__builtin_shuffle(b, sel) >> shift) & 1;
+        v = -__builtin_convertvector(b, V);
+    }
+};
+
+/*
+ * Policies of SpaChainSolver. With constant_time (the default) every cell of every row is processed.
+ * With public_scalar, cells that cannot lead to a chain shorter than the shortest one found so far are skipped
+ * and the DP stops as soon as a whole row is skipped, as in ChainSolver. The work then depends on the scalar,
+ * so it is only meant for scalars that are not secret (verification keys, for example).
+ * */
+struct constant_time {
+    static const bool prune = false;
+};
+
+struct public_scalar {
+    static const bool prune = true;
+};
+
+/*
+ * Same state and movements array as ChainSolver (see solver.h), with the rows processed by the widest
+ * kernel supported by the CPU. Kernels process the cells of a row from 'start', which is always 0
+ * under the constant_time policy.
+ * */
+template <int64_t width, typename policy = constant_time>
+class SpaChainSolver
+{
+public:
+    typedef bigint_t<width> scalar_t;
+
+    SpaChainSolver() : row_kernel(select_row_kernel()) {}
+
+    void solve(const scalar_t &a, chain_t &shortest);
+
+    /* Call term(i, j, negative) for every term of a chain found by the last call to solve() */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const
+    {
+        walk_chain(T, &chain, term);
+    }
+
+private:
+    typedef typename dp_size<width>::weight_t weight_t;
+    static const int64_t max_size = dp_size<width>::max_size;
+    static const int64_t max_rows = dp_size<width>::max_rows;
+    static const int64_t max_cells = dp_size<width>::max_cells;
+
+    typedef weight_t vweight128_t __attribute__((vector_size(16)));
+    typedef weight_t vweight256_t __attribute__((vector_size(32)));
+    typedef weight_t vweight512_t __attribute__((vector_size(64)));
+
+    typedef void (SpaChainSolver::*row_kernel_t)(int64_t, int64_t, int64_t, int8_t, int8_t,
+                                                 const uint64_t *, const uint64_t *, const uint64_t *);
+
+    /*
+     * Weights of positive (P) and negative (N) chains.
+     * We just need two rows of information for previous and current chains.
+     * */
+    weight_row_t<width> weights[2];
+
+    /* Weights reached by vertical steps into the current row, before its horizontal steps (used by the vector kernels) */
+    weight_row_t<width> vert_weights;
+
+    /* Movements array, with row j holding its cells 0 to plane.msb[j]+2 from T[j] on */
+    int8_t T_cells[max_cells];
+    int8_t *T[max_rows];
+
+    /* Quotients n/3^j and vertical step predicates for every row, computed before the DP */
+    plane_t<width> plane;
+
+    /* Kernel processing one row of the DP, chosen once per solver */
+    row_kernel_t row_kernel;
+
+    void step(int64_t v1, weight_t *v2, int8_t &t, int64_t mov);
+    void shorter_chain(int64_t i, int64_t j, int8_t row, int64_t start, chain_t &shortest);
+    void row_generic(int64_t j, int64_t size, int64_t start, int8_t curr, int8_t next,
+                     const uint64_t *bits, const uint64_t *vert, const uint64_t *vert_carry);
+    template <typename V>
+    KERNEL_INLINE void row_cells(int64_t i, int64_t j, int8_t curr, int8_t next,
+                                 const uint64_t *bits, const uint64_t *vert, const uint64_t *vert_carry);
+    template <typename V>
+    KERNEL_INLINE void row_vector(int64_t j, int64_t size, int64_t start, int8_t curr, int8_t next,
+                                  const uint64_t *bits, const uint64_t *vert, const uint64_t *vert_carry);
+#ifndef GENERIC_KERNEL
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("avx512f,avx512bw")))
+    void row_avx512(int64_t j, int64_t size, int64_t start, int8_t curr, int8_t next,
+                    const uint64_t *bits, const uint64_t *vert, const uint64_t *vert_carry)
+    {
+        row_vector<vweight512_t>(j, size, start, curr, next, bits, vert, vert_carry);
+    }
+
+    __attribute__((target("avx2")))
+    void row_avx2(int64_t j, int64_t size, int64_t start, int8_t curr, int8_t next,
+                  const uint64_t *bits, const uint64_t *vert, const uint64_t *vert_carry)
+    {
+        row_vector<vweight256_t>(j, size, start, curr, next, bits, vert, vert_carry);
+    }
+#endif
+
+    /* 128-bit vectors: SSE2 on x86-64, NEON on AArch64 */
+    void row_simd128(int64_t j, int64_t size, int64_t start, int8_t curr, int8_t next,
+                     const uint64_t *bits, const uint64_t *vert, const uint64_t *vert_carry)
+    {
+        row_vector<vweight128_t>(j, size, start, curr, next, bits, vert, vert_carry);
+    }
+#endif
+    static row_kernel_t select_row_kernel();
+};
+
+template <int64_t width, typename policy>
+inline void SpaChainSolver<width, policy>::step(int64_t v1, weight_t *v2, int8_t &t, int64_t mov)
+{
+    /* All ones if v1 is shorter, from the sign of v1 - *v2 (weights are small, so it cannot overflow) */
+    int64_t update = sign_mask(v1 - (int64_t)*v2);
+    /* Wipe left or right side of bits before setting new values.
+     * To clear left side and keep right side unchanged: &= 15 (xxxx-1111).
+     * To clear right side and keep left side unchanged: &= 240 (1111-xxxx).
+     * mov is a constant at every call, so clear is too. */
+    int8_t clear = (mov < 16) ? 240: 15;
+    *v2 = (weight_t)mask_select<int64_t>(update, v1, *v2);
+    t = (int8_t)mask_select<int64_t>(update, (t & clear) | mov, t);
+}
+
+/*
+ * Keep cell i of a row as the end of the shortest chain if it is shorter. Under pruning, the cells of a row left of
+ * 'start' were not written for it and may still hold an older row. They cannot end a shorter chain (they only come
+ * from skipped cells), so they are not checked.
+ * */
+template <int64_t width, typename policy>
+inline void SpaChainSolver<width, policy>::shorter_chain(int64_t i, int64_t j, int8_t row, int64_t start,
+                                                         chain_t &shortest)
+{
+    if(policy::prune && i < start)
+        return;
+    int64_t weight = weights[row].P[i];
+    int64_t update = sign_mask(weight - shortest.weight);
+    shortest.weight = mask_select(update, weight, shortest.weight);
+    shortest.i = mask_select(update, i, shortest.i);
+    shortest.j = mask_select(update, j, shortest.j);
+}
+
+/*
+ * Process row j of the DP one cell at a time. Both horizontal cases and the three vertical ones are computed on
+ * copies of the cells, and the bits of the plane only pick the results through masks, so no branch or address
+ * depends on the scalar (the vector kernels fall back to this one for the short rows at the end of the plane).
+ * */
+template <int64_t width, typename policy>
+void SpaChainSolver<width, policy>::row_generic(int64_t j, int64_t size, int64_t start, int8_t curr, int8_t next,
+                                                const uint64_t *bits, const uint64_t *vert, const uint64_t *vert_carry)
+{
+    int64_t i, b, v, c;
+    weight_t p, n, p1, n1, p0, n0, vp[3], vn[3];
+    int8_t t, t1, t0, vt[3];
+    for(i = start; i <= size; i++)
+    {
+        b = -(int64_t)get_bit(bits, i);
+        v = -(int64_t)get_bit(vert, i);
+        c = -(int64_t)get_bit(vert_carry, i);
+        p = weights[curr].P[i];
+        n = weights[curr].N[i];
+        /* Horizontal steps. The movements of each cell are built in t and stored once */
+        t = T[j][i+1];
+        /* bit == 1 */
+        p1 = weights[curr].P[i+1];
+        n1 = weights[curr].N[i+1];
+        t1 = t;
+        step(n, &n1, t1, 64); /* (H, -, 0) => 0100-xxxx */
+        step(p+1, &p1, t1, 1); /* (H, +, +1) => xxxx-0001 */
+        step(p+1, &n1, t1, 48); /* (H, +, -1) => 0011-xxxx */
+        /* bit == 0 */
+        p0 = weights[curr].P[i+1];
+        n0 = weights[curr].N[i+1];
+        t0 = t;
+        step(p, &p0, t0, 0); /* (H, +, 0) => xxxx-0000 */
+        step(n+1, &n0, t0, 112); /* (H, -, -1) => 0111-xxxx */
+        step(n+1, &p0, t0, 5); /* (H, -, +1) => xxxx-0101 */
+        weights[curr].P[i+1] = (weight_t)mask_select<int64_t>(b, p1, p0);
+        weights[curr].N[i+1] = (weight_t)mask_select<int64_t>(b, n1, n0);
+        T[j][i+1] = (int8_t)mask_select<int64_t>(b, t1, t0);
+        /* Vertical steps. vert: (V, +, +1) and then (V, -, -1), whatever vert_carry is */
+        vp[0] = p+1;
+        vn[0] = max_size;
+        vt[0] = 9; /* (V, +, +1) => xxxx-1001 */
+        step(n+1, &vn[0], vt[0], 240); /* (V, -, -1) => 1111-xxxx */
+        /* !vert && vert_carry */
+        vn[1] = n;
+        vp[1] = max_size;
+        vt[1] = (int8_t)192; /* (V, -, 0) => 1100-xxxx */
+        step(p+1, &vn[1], vt[1], 176); /* (V, +, -1) => 1011-xxxx */
+        /* !vert && !vert_carry */
+        vp[2] = p;
+        vn[2] = max_size;
+        vt[2] = 8; /* (V, +, 0) => 1000-xxxx */
+        step(n+1, &vp[2], vt[2], 13); /* (V, -, +1) => xxxx-1101 */
+        weights[next].P[i] = (weight_t)mask_select<int64_t>(v, vp[0], mask_select<int64_t>(c, vp[1], vp[2]));
+        weights[next].N[i] = (weight_t)mask_select<int64_t>(v, vn[0], mask_select<int64_t>(c, vn[1], vn[2]));
+        T[j+1][i] = (int8_t)mask_select<int64_t>(v, vt[0], mask_select<int64_t>(c, vt[1], vt[2]));
+    }
+}
+
+/*
+ * Vector kernel, written with GCC vector extensions so the same code is compiled for every instruction set.
+ * The horizontal weights of a row depend on the cell to their left, so they are computed first in a single
+ * sequential pass (keeping the weights reached by vertical steps in vert_weights). Every cell is then
+ * independent: the horizontal movements of T[j] and the vertical steps into row j+1 are done 'lanes' cells
+ * at a time, choosing weights and movements with masked blends instead of branches.
+ * */
+
+/* Horizontal movements into cells i+1 to i+lanes of row j, and vertical steps from cells i to i+lanes-1 into row j+1 */
+template <int64_t width, typename policy>
+template <typename V>
+KERNEL_INLINE void SpaChainSolver<width, policy>::row_cells(int64_t i, int64_t j, int8_t curr, int8_t next,
+                                                            const uint64_t *bits, const uint64_t *vert,
+                                                            const uint64_t *vert_carry)
+{
+    typedef lane_ops<weight_t, V> ops;
+    V p, n, vp, vn, t, hi, lo, b, v, c, m, m1, m2, m3, pn, nn;
+    ops::load(p, &weights[curr].P[i]);
+    ops::load(n, &weights[curr].N[i]);
+    ops::load(vp, &vert_weights.P[i+1]);
+    ops::load(vn, &vert_weights.N[i+1]);
+    ops::load_bytes(t, &T[j][i+1]);
+    ops::mask(b, bits, i);
+    /* bit == 1: (H, -, 0), (H, +, +1) and then (H, +, -1) */
+    m1 = (n < vn);
+    m2 = (p+1 < vp);
+    m3 = (p+1 < (m1 ? n: vn));
+    hi = m3 ? (V{} + 48): m1 ? (V{} + 64): (t & 240);
+    lo = m2 ? (V{} + 1): (t & 15);
+    t = b ? (hi | lo): t;
+    /* bit == 0: (H, +, 0), (H, -, -1) and then (H, -, +1) */
+    m1 = (p < vp);
+    m2 = (n+1 < vn);
+    m3 = (n+1 < (m1 ? p: vp));
+    hi = m2 ? (V{} + 112): (t & 240);
+    lo = m3 ? (V{} + 5): m1 ? (V{} + 0): (t & 15);
+    t = b ? t: (hi | lo);
+    ops::store_bytes(&T[j][i+1], t);
+    ops::mask(v, vert, i);
+    ops::mask(c, vert_carry, i);
+    /* vert: (V, +, +1) and then (V, -, -1) */
+    m = (n+1 < max_size);
+    pn = p+1;
+    nn = m ? n+1: (V{} + max_size);
+    t = m ? (V{} + 249): (V{} + 9);
+    /* !vert && vert_carry: (V, -, 0) and then (V, +, -1) */
+    m1 = (p+1 < n);
+    pn = (~v & c) ? (V{} + max_size): pn;
+    nn = (~v & c) ? (m1 ? p+1: n): nn;
+    t = (~v & c) ? (m1 ? (V{} + 176): (V{} + 192)): t;
+    /* !vert && !vert_carry: (V, +, 0) and then (V, -, +1) */
+    m2 = (n+1 < p);
+    pn = (~v & ~c) ? (m2 ? n+1: p): pn;
+    nn = (~v & ~c) ? (V{} + max_size): nn;
+    t = (~v & ~c) ? (m2 ? (V{} + 13): (V{} + 8)): t;
+    ops::store(&weights[next].P[i], pn);
+    ops::store(&weights[next].N[i], nn);
+    ops::store_bytes(&T[j+1][i], t);
+}
+
+template <int64_t width, typename policy>
+template <typename V>
+KERNEL_INLINE void SpaChainSolver<width, policy>::row_vector(int64_t j, int64_t size, int64_t start,
+                                                             int8_t curr, int8_t next, const uint64_t *bits,
+                                                             const uint64_t *vert, const uint64_t *vert_carry)
+{
+    const int64_t lanes = lane_ops<weight_t, V>::lanes;
+    weight_t p, n, x, y, m, *P = weights[curr].P, *N = weights[curr].N;
+    int64_t i;
+    if(size+1-start < lanes)
+    {
+        row_generic(j, size, start, curr, next, bits, vert, vert_carry);
+        return;
+    }
+    memcpy(vert_weights.P+start, P+start, (size+2-start)*sizeof(weight_t));
+    memcpy(vert_weights.N+start, N+start, (size+2-start)*sizeof(weight_t));
+    /* Horizontal weights, carrying the weights of the previous cell in registers.
+     * With x = (bit ? n: p) and y = (bit ? p: n), the chain of the same sign as the bit can only improve
+     * through min(x, y+1) and the other one gets y+1, so both cases share the same operations. */
+    p = P[start];
+    n = N[start];
+    for(i = start; i <= size; i++)
+    {
+        m = -(weight_t)get_bit(bits, i);
+        x = mask_select(m, n, p);
+        y = mask_select(m, p, n);
+        x = mask_min<weight_t>(x, y+1);
+        y = y+1;
+        p = mask_min(P[i+1], mask_select(m, y, x));
+        n = mask_min(N[i+1], mask_select(m, x, y));
+        P[i+1] = p;
+        N[i+1] = n;
+    }
+    /* Movements and vertical steps, 'lanes' cells at a time. When the row is not a multiple of 'lanes' long
+     * the last vector overlaps the previous one, which is harmless since recomputing a cell gives the same result. */
+    for(i = start; i+lanes < size+1; i += lanes)
+        row_cells<V>(i, j, curr, next, bits, vert, vert_carry);
+    row_cells<V>(size+1-lanes, j, curr, next, bits, vert, vert_carry);
+}
+
+/* Names with the bit width as only parameter, for ChainDispatcher (dispatch.h) */
+template <int64_t width>
+using ConstantTimeSpaSolver = SpaChainSolver<width, constant_time>;
+
+template <int64_t width>
+using PublicSpaSolver = SpaChainSolver<width, public_scalar>;
+
+/*
+ * Pick the widest kernel supported by the CPU. The choice depends only on the machine, never on the scalar.
+ * Compiling with -D GENERIC_KERNEL keeps the one-cell-at-a-time kernel.
+ * */
+template <int64_t width, typename policy>
+typename SpaChainSolver<width, policy>::row_kernel_t SpaChainSolver<width, policy>::select_row_kernel()
+{
+#ifdef GENERIC_KERNEL
+    return &SpaChainSolver::row_generic;
+#else
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512bw"))
+        return &SpaChainSolver::row_avx512;
+    if(__builtin_cpu_supports("avx2"))
+        return &SpaChainSolver::row_avx2;
+#endif
+    return &SpaChainSolver::row_simd128;
+#endif
+}
+
+template <int64_t width, typename policy>
+void SpaChainSolver<width, policy>::solve(const scalar_t &a, chain_t &shortest)
+{
+    int64_t i, j, size, start = 0;
+    int8_t curr, next, aux;
+    const uint64_t *bits, *vert, *vert_carry;
+    /* Initialization. Row 0 is only read up to cell msb+2, and every later row is written before it is read */
+    for(i = 0; i <= a.msb+2; i++)
+        weights[0].P[i] = weights[0].N[i] = max_size;
+    /* Zero has the empty chain */
+    shortest.weight = (a.zero) ? 0: max_size;
+    shortest.i = shortest.j = 0;
+    /* base case */
+    weights[0].P[0] = j = curr = 0;
+    next = 1;
+    fill_plane(&a, &plane, divide_by_3_ct<width>);
+    layout_rows(&plane, T_cells, T);
+    for(j = 0; j < plane.rows; j++)
+    {
+        bits = plane.bits[j];
+        vert = plane.vert[j];
+        vert_carry = plane.vert_carry[j];
+        size = plane.msb[j];
+        weights[next].P[size+1] = weights[next].N[size+1] = max_size;
+        weights[next].P[size+2] = weights[next].N[size+2] = max_size;
+        (this->*row_kernel)(j, size, start, curr, next, bits, vert, vert_carry);
+        /* Check if this iteration produced a chain shorter than the shortest so far */
+        shorter_chain(size+1, j, curr, start, shortest);
+        shorter_chain(size+2, j, curr, start, shortest);
+        size = plane.msb[j+1];
+        shorter_chain(size+1, j, next, start, shortest);
+        shorter_chain(size+2, j, next, start, shortest);
+        /* Skip the cells on the left of the next row that cannot lead to a shorter chain, even counting the term
+         * that is still needed while the rest of the scalar (or the borrow of a negative chain) is not zero.
+         * Those cells only reach cells that are skipped too, and the DP is over when the whole row is skipped. */
+        if(policy::prune)
+        {
+            while(start <= size && weights[next].P[start] + (start < size) >= shortest.weight &&
+                  weights[next].N[start] + 1 >= shortest.weight)
+                start++;
+            if(start > size) break;
+        }
+        /* Next iteration */
+        aux = curr;
+        curr = next;
+        next = aux;
+    }
+}
+
+#endif
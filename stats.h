@@ -0,0 +1,201 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Instrumentation of ChainSolver (solver.h), compiled in with -D CHAIN_STATS: rows and cells of the DP that were
+ * processed or pruned, where the chains end, and the time spent computing the quotients, in the DP and writing
+ * the chains. Without CHAIN_STATS the counters do not exist and every function here compiles to nothing.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include "dp.h"
+
+#ifdef CHAIN_STATS
+static const bool stats_enabled = true;
+#else
+static const bool stats_enabled = false;
+#endif
+
+/*
+ * Phases of a scalar: the quotients n/3^j and the predicates of the vertical steps (fill_plane(), mostly
+ * divide_by_3), the DP itself, and the backtracking and printing or formatting of the chain
+ * */
+enum stats_phase_t {
+    stats_divide,
+    stats_dp,
+    stats_output,
+    stats_phases
+};
+
+static const char *const stats_phase_names[stats_phases] = {"divide", "dp", "output"};
+
+#ifdef CHAIN_STATS
+/*
+ * Totals over every scalar, updated once per scalar so that the threads of batch mode share them cheaply.
+ * Cells are 'visited' when their steps are computed, 'pruned' when both of their weights are already as large as
+ * the shortest chain (or its bound under a cost model), and 'cut' when they are in the rows after the DP stops.
+ * */
+typedef struct {
+    std::atomic<uint64_t> scalars;
+    std::atomic<uint64_t> rows, rows_cut;
+    std::atomic<uint64_t> cells_visited, cells_pruned, cells_cut;
+    /* Sums of the weight and of the cell (i, j) of every chain, and those of the last one */
+    std::atomic<uint64_t> weight, chain_i, chain_j;
+    std::atomic<int64_t> last_weight, last_i, last_j;
+    std::atomic<uint64_t> nanoseconds[stats_phases];
+} chain_stats_t;
+
+static chain_stats_t chain_stats;
+
+/* Format for stats_write_at_exit(), NULL for none */
+static const char *stats_format = NULL;
+#endif
+
+/* Current time in nanoseconds, to start timing a phase */
+static inline uint64_t stats_clock()
+{
+#ifdef CHAIN_STATS
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+    return 0;
+#endif
+}
+
+/* Add the time since 'start' to a phase. Returns the current time, which starts the next phase */
+static inline uint64_t stats_lap(stats_phase_t phase, uint64_t start)
+{
+#ifdef CHAIN_STATS
+    uint64_t now = stats_clock();
+    chain_stats.nanoseconds[phase].fetch_add(now - start, std::memory_order_relaxed);
+    return now;
+#else
+    (void)phase;
+    return start;
+#endif
+}
+
+/*
+ * Counters of one scalar, whose DP processed rows 0 to rows-1 of the plane, visiting or pruning those many cells,
+ * and found 'chain'
+ * */
+template <int64_t width>
+static inline void stats_record(const plane_t<width> &plane, int64_t rows, int64_t visited, int64_t pruned,
+                                const chain_t &chain)
+{
+#ifdef CHAIN_STATS
+    uint64_t cut = 0;
+    for(int64_t j = rows; j < plane.rows; j++)
+        cut += plane.msb[j]+1;
+    chain_stats.scalars.fetch_add(1, std::memory_order_relaxed);
+    chain_stats.rows.fetch_add(rows, std::memory_order_relaxed);
+    chain_stats.rows_cut.fetch_add(plane.rows - rows, std::memory_order_relaxed);
+    chain_stats.cells_visited.fetch_add(visited, std::memory_order_relaxed);
+    chain_stats.cells_pruned.fetch_add(pruned, std::memory_order_relaxed);
+    chain_stats.cells_cut.fetch_add(cut, std::memory_order_relaxed);
+    chain_stats.weight.fetch_add(chain.weight, std::memory_order_relaxed);
+    chain_stats.chain_i.fetch_add(chain.i, std::memory_order_relaxed);
+    chain_stats.chain_j.fetch_add(chain.j, std::memory_order_relaxed);
+    chain_stats.last_weight.store(chain.weight, std::memory_order_relaxed);
+    chain_stats.last_i.store(chain.i, std::memory_order_relaxed);
+    chain_stats.last_j.store(chain.j, std::memory_order_relaxed);
+#else
+    (void)plane;
+    (void)rows;
+    (void)visited;
+    (void)pruned;
+    (void)chain;
+#endif
+}
+
+/* Write the counters as a JSON object ("json") or in the Prometheus text format ("prometheus") */
+static inline int stats_write(FILE *out, const char *format)
+{
+#ifdef CHAIN_STATS
+    const chain_stats_t &s = chain_stats;
+    int64_t k;
+    if(strcmp(format, "json") == 0)
+    {
+        fprintf(out, "{\"scalars\": %" PRIu64 ", \"rows\": {\"processed\": %" PRIu64 ", \"cut\": %" PRIu64 "}, ",
+                s.scalars.load(), s.rows.load(), s.rows_cut.load());
+        fprintf(out, "\"cells\": {\"visited\": %" PRIu64 ", \"pruned\": %" PRIu64 ", \"cut\": %" PRIu64 "}, ",
+                s.cells_visited.load(), s.cells_pruned.load(), s.cells_cut.load());
+        fprintf(out, "\"chains\": {\"weight\": %" PRIu64 ", \"i\": %" PRIu64 ", \"j\": %" PRIu64 "}, ",
+                s.weight.load(), s.chain_i.load(), s.chain_j.load());
+        fprintf(out, "\"last_chain\": {\"weight\": %" PRId64 ", \"i\": %" PRId64 ", \"j\": %" PRId64 "}, ",
+                s.last_weight.load(), s.last_i.load(), s.last_j.load());
+        fprintf(out, "\"seconds\": {");
+        for(k = 0; k < stats_phases; k++)
+            fprintf(out, "%s\"%s\": %.9f", (k > 0) ? ", ": "", stats_phase_names[k], s.nanoseconds[k].load()/1e9);
+        fprintf(out, "}}\n");
+        return 0;
+    }
+    if(strcmp(format, "prometheus") == 0)
+    {
+        fprintf(out, "# HELP chains23_scalars_total Scalars solved by ChainSolver.\n");
+        fprintf(out, "# TYPE chains23_scalars_total counter\n");
+        fprintf(out, "chains23_scalars_total %" PRIu64 "\n", s.scalars.load());
+        fprintf(out, "# HELP chains23_rows_total Rows of the DP, processed or cut by the early stop.\n");
+        fprintf(out, "# TYPE chains23_rows_total counter\n");
+        fprintf(out, "chains23_rows_total{state=\"processed\"} %" PRIu64 "\n", s.rows.load());
+        fprintf(out, "chains23_rows_total{state=\"cut\"} %" PRIu64 "\n", s.rows_cut.load());
+        fprintf(out, "# HELP chains23_cells_total Cells of the DP, visited, pruned by the weight bound or cut.\n");
+        fprintf(out, "# TYPE chains23_cells_total counter\n");
+        fprintf(out, "chains23_cells_total{state=\"visited\"} %" PRIu64 "\n", s.cells_visited.load());
+        fprintf(out, "chains23_cells_total{state=\"pruned\"} %" PRIu64 "\n", s.cells_pruned.load());
+        fprintf(out, "chains23_cells_total{state=\"cut\"} %" PRIu64 "\n", s.cells_cut.load());
+        fprintf(out, "# HELP chains23_chain_sum Sums of the weight and of the cell (i, j) of every chain.\n");
+        fprintf(out, "# TYPE chains23_chain_sum counter\n");
+        fprintf(out, "chains23_chain_sum{value=\"weight\"} %" PRIu64 "\n", s.weight.load());
+        fprintf(out, "chains23_chain_sum{value=\"i\"} %" PRIu64 "\n", s.chain_i.load());
+        fprintf(out, "chains23_chain_sum{value=\"j\"} %" PRIu64 "\n", s.chain_j.load());
+        fprintf(out, "# HELP chains23_last_chain Weight and cell (i, j) of the last chain.\n");
+        fprintf(out, "# TYPE chains23_last_chain gauge\n");
+        fprintf(out, "chains23_last_chain{value=\"weight\"} %" PRId64 "\n", s.last_weight.load());
+        fprintf(out, "chains23_last_chain{value=\"i\"} %" PRId64 "\n", s.last_i.load());
+        fprintf(out, "chains23_last_chain{value=\"j\"} %" PRId64 "\n", s.last_j.load());
+        fprintf(out, "# HELP chains23_phase_seconds_total Time per phase of the solver.\n");
+        fprintf(out, "# TYPE chains23_phase_seconds_total counter\n");
+        for(k = 0; k < stats_phases; k++)
+            fprintf(out, "chains23_phase_seconds_total{phase=\"%s\"} %.9f\n", stats_phase_names[k],
+                    s.nanoseconds[k].load()/1e9);
+        return 0;
+    }
+#else
+    (void)out;
+    (void)format;
+#endif
+    return -1;
+}
+
+#ifdef CHAIN_STATS
+static void stats_write_format()
+{
+    stats_write(stderr, stats_format);
+}
+#endif
+
+/*
+ * Write the counters to stderr in 'format' when the program exits. Returns -1 for an unknown format, or when
+ * the program was built without CHAIN_STATS.
+ * */
+static inline int stats_write_at_exit(const char *format)
+{
+#ifdef CHAIN_STATS
+    if(strcmp(format, "json") != 0 && strcmp(format, "prometheus") != 0)
+        return -1;
+    stats_format = format;
+    return atexit(stats_write_format);
+#else
+    (void)format;
+    return -1;
+#endif
+}
+
+#endif
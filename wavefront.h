@@ -0,0 +1,286 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Optimal 2-3 chains for very large scalars, computing one DP with several threads.
+ */
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "solver.h"
+
+/*
+ * Cell (i, j) of the DP only depends on (i-1, j) and (i, j-1), so the grid is cut in tiles of tile_rows rows by
+ * tile_cols columns and a tile can be processed as soon as the tiles to its left and above it are done. Tiles
+ * become ready along anti-diagonals; every thread pushes the tiles it releases to its own queue and steals from
+ * the queues of the others when its own is empty.
+ *
+ * The pruning of ChainSolver needs the shortest chain of every previous row before a row starts, which would
+ * serialize the rows, so the tiles compute every cell with the same steps and without pruning. Then the checks of
+ * ChainSolver are replayed row by row on the stored weights. Pruning only ever drops candidates of weight equal or
+ * greater than the shortest chain so far, so every weight below it (and its movements) is the same as in
+ * ChainSolver, and the replay finds exactly the same shortest chain. The one exception is the first cell of the
+ * chain when it ends in the row after the one where ChainSolver stops: its movements are saved before horizontal
+ * steps of that row, which ChainSolver never does, can change them.
+ *
+ * Unlike ChainSolver, the weights of every cell are kept (in the same layout as T), which at 4096 bits is about
+ * 20 MiB per solver, so solvers come from new_solver().
+ * */
+template <int64_t width>
+class WavefrontChainSolver
+{
+public:
+    typedef bigint_t<width> scalar_t;
+
+    WavefrontChainSolver(int64_t threads = 1, int64_t tile_rows = 16, int64_t tile_cols = 256);
+
+    void solve(const scalar_t &a, chain_t &shortest);
+
+    /* Call term(i, j, negative) for every term of a chain found by the last call to solve() */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const
+    {
+        walk_chain(T, &chain, term);
+    }
+
+private:
+    typedef typename dp_size<width>::weight_t weight_t;
+    static const int64_t max_size = dp_size<width>::max_size;
+    static const int64_t max_rows = dp_size<width>::max_rows;
+    static const int64_t max_cells = dp_size<width>::max_cells;
+
+    typedef struct {
+        std::mutex lock;
+        std::deque<int64_t> tiles;
+    } tile_queue_t;
+
+    /* Weights of positive (P) and negative (N) chains of every cell, laid out like T */
+    weight_t P_cells[max_cells];
+    weight_t N_cells[max_cells];
+    weight_t *P[max_rows];
+    weight_t *N[max_rows];
+
+    /* Movements array, with row j holding its cells 0 to plane.msb[j]+2 from T[j] on (see solver.h) */
+    int8_t T_cells[max_cells];
+    int8_t *T[max_rows];
+
+    /*
+     * Weights and movements of cells plane.msb[j]+1 and plane.msb[j]+2 of row j after the vertical steps
+     * into them, before the horizontal steps of row j
+     * */
+    weight_t first_P[max_rows][2];
+    int8_t first_T[max_rows][2];
+
+    /* Quotients n/3^j and vertical step predicates for every row, computed before the DP */
+    plane_t<width> plane;
+
+    int64_t threads, tile_rows, tile_cols, tiles_x, tiles_y;
+    std::atomic<int64_t> remaining;
+    std::unique_ptr<std::atomic<int32_t>[]> deps;
+    std::unique_ptr<tile_queue_t[]> queues;
+
+    bool tile_exists(int64_t x, int64_t y) const;
+    void run_tile(int64_t x, int64_t y);
+    void release(int64_t x, int64_t y, int64_t worker);
+    bool next_tile(int64_t worker, int64_t &tile);
+    void work(int64_t worker);
+};
+
+template <int64_t width>
+WavefrontChainSolver<width>::WavefrontChainSolver(int64_t threads, int64_t tile_rows, int64_t tile_cols)
+    : threads((threads < 1) ? 1: threads), tile_rows((tile_rows < 1) ? 1: tile_rows),
+      tile_cols((tile_cols < 1) ? 1: tile_cols), remaining(0)
+{
+    int64_t count;
+    tiles_x = (max_size+3 + this->tile_cols-1)/this->tile_cols;
+    tiles_y = (max_rows + this->tile_rows-1)/this->tile_rows;
+    count = tiles_x*tiles_y;
+    deps.reset(new std::atomic<int32_t>[count]);
+    queues.reset(new tile_queue_t[this->threads]);
+}
+
+/* Rows get shorter further down, so a tile exists if its first row reaches its first column */
+template <int64_t width>
+inline bool WavefrontChainSolver<width>::tile_exists(int64_t x, int64_t y) const
+{
+    return x < tiles_x && y*tile_rows < plane.rows && x*tile_cols < plane.msb[y*tile_rows]+3;
+}
+
+/* Same steps as ChainSolver, from every cell of the tile, in row order */
+template <int64_t width>
+void WavefrontChainSolver<width>::run_tile(int64_t x, int64_t y)
+{
+    int64_t i, j, size, end, last;
+    const uint64_t *bits, *vert, *vert_carry;
+    for(j = y*tile_rows; j < (y+1)*tile_rows && j < plane.rows; j++)
+    {
+        bits = plane.bits[j];
+        vert = plane.vert[j];
+        vert_carry = plane.vert_carry[j];
+        size = plane.msb[j];
+        /* Vertical steps only reach the cells of row j+1 that exist */
+        last = plane.msb[j+1]+2;
+        end = (x+1)*tile_cols;
+        if(end > size+3)
+            end = size+3;
+        for(i = x*tile_cols; i < end; i++)
+        {
+            if(i > 0 && i-1 <= size)
+                horizontal_steps(get_bit(bits, i-1), P[j][i-1], N[j][i-1], P[j][i], N[j][i], T[j][i]);
+            if(i <= size && i <= last)
+            {
+                vertical_steps(get_bit(vert, i), get_bit(vert_carry, i), P[j][i], N[j][i],
+                               P[j+1][i], N[j+1][i], T[j+1][i], max_size);
+                if(i >= last-1)
+                {
+                    first_P[j+1][i-last+1] = P[j+1][i];
+                    first_T[j+1][i-last+1] = T[j+1][i] & 15;
+                }
+            }
+        }
+    }
+}
+
+/* Count the tile (x, y) as done for the tiles to its right and below it, queueing those that become ready */
+template <int64_t width>
+void WavefrontChainSolver<width>::release(int64_t x, int64_t y, int64_t worker)
+{
+    int64_t k, tile[2][2] = {{x+1, y}, {x, y+1}};
+    for(k = 0; k < 2; k++)
+    {
+        if(tile_exists(tile[k][0], tile[k][1]) && --deps[tile[k][1]*tiles_x + tile[k][0]] == 0)
+        {
+            std::lock_guard<std::mutex> guard(queues[worker].lock);
+            queues[worker].tiles.push_back(tile[k][1]*tiles_x + tile[k][0]);
+        }
+    }
+}
+
+/* Newest tile of the worker's own queue, or else the oldest one of another queue */
+template <int64_t width>
+bool WavefrontChainSolver<width>::next_tile(int64_t worker, int64_t &tile)
+{
+    int64_t k, victim;
+    for(k = 0; k < threads; k++)
+    {
+        victim = (worker+k) % threads;
+        std::lock_guard<std::mutex> guard(queues[victim].lock);
+        if(!queues[victim].tiles.empty())
+        {
+            if(k == 0)
+            {
+                tile = queues[victim].tiles.back();
+                queues[victim].tiles.pop_back();
+            }
+            else
+            {
+                tile = queues[victim].tiles.front();
+                queues[victim].tiles.pop_front();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+template <int64_t width>
+void WavefrontChainSolver<width>::work(int64_t worker)
+{
+    int64_t tile;
+    while(remaining > 0)
+    {
+        if(next_tile(worker, tile))
+        {
+            run_tile(tile % tiles_x, tile / tiles_x);
+            release(tile % tiles_x, tile / tiles_x, worker);
+            remaining--;
+        }
+        else
+            std::this_thread::yield();
+    }
+}
+
+template <int64_t width>
+void WavefrontChainSolver<width>::solve(const scalar_t &a, chain_t &shortest)
+{
+    int64_t i, j, x, y, size, cont, count = 0, first = -1;
+    std::vector<std::thread> pool;
+    fill_plane(&a, &plane, divide_by_3<width>);
+    layout_rows(&plane, T_cells, T);
+    layout_rows(&plane, P_cells, P);
+    layout_rows(&plane, N_cells, N);
+    /* Cells not reached by vertical steps start unreachable, except for the base case */
+    for(j = 0; j <= plane.rows; j++)
+    {
+        for(i = (j == 0) ? 0: plane.msb[j-1]+1; i < plane.msb[j]+3; i++)
+        {
+            P[j][i] = N[j][i] = max_size;
+            T[j][i] = 0;
+        }
+        first_P[j][0] = first_P[j][1] = max_size;
+    }
+    P[0][0] = 0;
+    for(y = 0; y < tiles_y; y++)
+    {
+        for(x = 0; x < tiles_x; x++)
+        {
+            if(tile_exists(x, y))
+            {
+                deps[y*tiles_x + x] = (x > 0) + (y > 0);
+                count++;
+            }
+        }
+    }
+    remaining = count;
+    if(count > 0)
+    {
+        queues[0].tiles.push_back(0);
+        for(i = 1; i < threads; i++)
+            pool.emplace_back(&WavefrontChainSolver::work, this, i);
+        work(0);
+        for(i = 0; i < (int64_t)pool.size(); i++)
+            pool[i].join();
+    }
+    /* Replay the checks of ChainSolver */
+    shortest.weight = (a.zero) ? 0: max_size;
+    shortest.i = shortest.j = 0;
+    for(j = 0; j < plane.rows; j++)
+    {
+        cont = 0;
+        size = plane.msb[j];
+        for(i = 0; i <= size; i++)
+            cont += (P[j][i] >= shortest.weight && N[j][i] >= shortest.weight);
+        for(i = size+1; i <= size+2; i++)
+        {
+            if(P[j][i] < shortest.weight)
+            {
+                shortest.weight = P[j][i];
+                shortest.i = i;
+                shortest.j = j;
+                first = -1;
+            }
+        }
+        size = plane.msb[j+1];
+        for(i = size+1; i <= size+2; i++)
+        {
+            if(first_P[j+1][i-size-1] < shortest.weight)
+            {
+                shortest.weight = first_P[j+1][i-size-1];
+                shortest.i = i;
+                shortest.j = j+1;
+                first = first_T[j+1][i-size-1];
+            }
+        }
+        if(cont >= plane.msb[j]) break;
+    }
+    /* Only the positive half of the first cell is read by the backtracking */
+    if(first >= 0)
+        T[shortest.j][shortest.i] = (T[shortest.j][shortest.i] & 240) | (first & 15);
+}
+
+#endif
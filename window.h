@@ -0,0 +1,237 @@
+/*
+ * Copyright: Cristobal Leiva and Nicolas Theriault
+ * Optimal 2-3 chains with digits +-1, +-3, ..., +-(2w-1), for scalar multiplications that precompute the odd
+ * multiples 3P, 5P, ..., (2w-1)P.
+ */
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory>
+#include "dp.h"
+
+/*
+ * Cell (i, j) stands for r = n mod 2^i*3^j, the part of n below X = 2^i*3^j, and the positive and negative chains
+ * of ChainSolver (solver.h) are chains of r and r-X. With larger digits the chains of a cell must cover more
+ * values, so every cell has one state per offset k in [-D, D+1], D = 2w-1, holding the weight of the shortest
+ * chain of r-k*X (k = 0 and 1 are the P and N chains). Every path of the DP keeps k in that range.
+ *
+ * A horizontal step adds the bit b of the cell, b*X, to r, and a digit t (zero or odd) can be added with it:
+ * a chain of r-k*X plus t*X is a chain of r'-k'*2X with k' = (b+k-t)/2, so t must have the parity of b+k.
+ * A vertical step adds c*X (c is 0, 1 or 2 as in solver.h), and k' = (c+k-t)/3 for t = c+k mod 3.
+ *
+ * n = r + q*X with q = n/X, so the chain of r-k*X in a cell plus the term (k+q)*X is a chain of n whenever
+ * k+q is a digit. These top terms, for the few cells near the end of every row where q is small, are the
+ * candidates for the shortest chain.
+ *
+ * The weights are costs (see cost_t in dp.h): digits +-1 cost a mixed addition and the others a general one.
+ * A chain with its top term in cell (i, j) also costs i doublings and j triplings, which is the same for every
+ * chain through the cell, so the cost model only changes the weights of the digits and the choice of the top term.
+ * With term_cost the weights count terms and the chain is the shortest one.
+ *
+ * For every state of every cell the movements array keeps one 16-bit entry: bit 15 for vertical steps, bits
+ * 8 to 11 for the state of the previous cell and bits 0 to 7 for the digit added there. For w = 4 that is 16
+ * states, 32 times the movements array of ChainSolver, so it is allocated with the solver for the window given.
+ * */
+template <int64_t width>
+class WindowChainSolver
+{
+public:
+    typedef bigint_t<width> scalar_t;
+
+    static const int64_t max_window = 4;
+
+    explicit WindowChainSolver(int64_t window = 2);
+
+    void solve(const scalar_t &a, chain_t &shortest)
+    {
+        solve(a, shortest, term_cost);
+    }
+
+    /* Chain of least cost under the cost model */
+    void solve(const scalar_t &a, chain_t &shortest, const cost_t &cost);
+
+    /* Call term(i, j, digit) for every term digit*2^i*3^j of the chain found by the last call to solve() */
+    template <typename F>
+    void backtrack(const chain_t &chain, F term) const;
+
+private:
+    typedef int32_t weight_t;
+    static const weight_t unreachable = INT32_MAX/2;
+    static const int64_t max_size = dp_size<width>::max_size;
+    static const int64_t max_rows = dp_size<width>::max_rows;
+    static const int64_t max_cells = dp_size<width>::max_cells;
+    static const int64_t max_states = 4*max_window;
+
+    int64_t digit, states;
+
+    /* Weights of every state of two rows */
+    weight_t weights[2][max_size][max_states];
+
+    std::unique_ptr<uint16_t[]> moves;
+    int64_t row_start[max_rows];
+
+    /* Quotients n/3^j and vertical step predicates for every row, computed before the DP */
+    plane_t<width> plane;
+
+    /* State of the cell of the top term and its digit */
+    int64_t top_state, top_digit;
+
+    uint16_t &move(int64_t i, int64_t j, int64_t s)
+    {
+        return moves[(row_start[j] + i)*states + s];
+    }
+
+    uint16_t move(int64_t i, int64_t j, int64_t s) const
+    {
+        return moves[(row_start[j] + i)*states + s];
+    }
+};
+
+template <int64_t width>
+WindowChainSolver<width>::WindowChainSolver(int64_t window)
+{
+    if(window < 1)
+        window = 1;
+    if(window > max_window)
+        window = max_window;
+    digit = 2*window-1;
+    states = 2*digit+2;
+    moves.reset(new uint16_t[max_cells*states]);
+}
+
+template <int64_t width>
+void WindowChainSolver<width>::solve(const scalar_t &a, chain_t &shortest, const cost_t &cost)
+{
+    int64_t i, j, s, k, t, v, q, b, c, size, last, next_last, cont, start, steps, best;
+    weight_t (*curr)[max_states], (*next)[max_states], w, add[2*max_states];
+    const uint64_t *bits;
+    uint16_t from;
+    fill_plane(&a, &plane, divide_by_3<width>);
+    for(j = 0, start = 0; j <= plane.rows; j++)
+    {
+        row_start[j] = start;
+        start += plane.msb[j]+3;
+    }
+    /* Cost of adding the digit t, at add[t+digit] */
+    for(t = -digit; t <= digit; t++)
+        add[t+digit] = (t == 0) ? 0: (t == 1 || t == -1) ? cost.mixed_addition: cost.addition;
+    /* Zero has the empty chain */
+    best = (a.zero) ? 0: unreachable;
+    shortest.i = shortest.j = 0;
+    top_state = digit;
+    top_digit = 0;
+    for(i = 0; i < plane.msb[0]+3; i++)
+        for(s = 0; s < states; s++)
+            weights[0][i][s] = unreachable;
+    weights[0][0][digit] = 0; /* base case, k = 0 */
+    for(j = 0; j <= plane.rows; j++)
+    {
+        curr = weights[j & 1];
+        next = weights[(j+1) & 1];
+        bits = plane.bits[j];
+        size = plane.msb[j];
+        last = size+2;
+        next_last = (j < plane.rows) ? plane.msb[j+1]+2: -1;
+        for(i = 0; i <= next_last; i++)
+            for(s = 0; s < states; s++)
+                next[i][s] = unreachable;
+        cont = 0;
+        for(i = 0; i <= last; i++)
+        {
+            /* Every chain through the cell costs at least its weight and the steps to reach it */
+            steps = cost.doubling*i + cost.tripling*j;
+            for(s = 0; s < states && curr[i][s] + steps >= best; s++);
+            if(s == states)
+            {
+                cont++;
+                continue;
+            }
+            if(i >= size-5)
+            {
+                for(q = 0, k = size-1; k >= i; k--)
+                    q = 2*q + get_bit(bits, k);
+                for(s = 0; s < states; s++)
+                {
+                    t = s-digit+q;
+                    if((t & 1) && t <= digit && t >= -digit && curr[i][s] + steps < best)
+                    {
+                        best = curr[i][s] + steps;
+                        shortest.i = i;
+                        shortest.j = j;
+                        top_state = s;
+                        top_digit = t;
+                    }
+                }
+            }
+            b = get_bit(bits, i);
+            c = (j == plane.rows) ? 0: (get_bit(plane.vert[j], i)) ? 1: (get_bit(plane.vert_carry[j], i)) ? 2: 0;
+            for(s = 0; s < states; s++)
+            {
+                w = curr[i][s];
+                if(w >= unreachable)
+                    continue;
+                k = s-digit;
+                /* Horizontal steps, with t = 0 or any odd digit of the parity of b+k */
+                if(i < last)
+                {
+                    v = b+k;
+                    for(t = (v & 1) ? -digit: 0; t <= ((v & 1) ? digit: 0); t += 2)
+                    {
+                        from = (uint16_t)(s << 8) | (uint8_t)(int8_t)t;
+                        if(w + add[t+digit] < curr[i+1][(v-t)/2 + digit])
+                        {
+                            curr[i+1][(v-t)/2 + digit] = w + add[t+digit];
+                            move(i+1, j, (v-t)/2 + digit) = from;
+                        }
+                    }
+                }
+                /* Vertical steps, with t = 0 or any odd digit congruent to c+k mod 3 */
+                if(i <= next_last)
+                {
+                    v = c+k;
+                    for(t = -digit; t <= digit; t++)
+                    {
+                        if((t != 0 && !(t & 1)) || (v-t) % 3 != 0)
+                            continue;
+                        from = 32768 | (uint16_t)(s << 8) | (uint8_t)(int8_t)t;
+                        if(w + add[t+digit] < next[i][(v-t)/3 + digit])
+                        {
+                            next[i][(v-t)/3 + digit] = w + add[t+digit];
+                            move(i, j+1, (v-t)/3 + digit) = from;
+                        }
+                    }
+                }
+            }
+        }
+        if(cont > last) break;
+    }
+    /* The weight of the chain is its number of terms */
+    shortest.weight = 0;
+    backtrack(shortest, [&](int64_t, int64_t, int64_t) { shortest.weight++; });
+}
+
+template <int64_t width>
+template <typename F>
+void WindowChainSolver<width>::backtrack(const chain_t &chain, F term) const
+{
+    int64_t i = chain.i, j = chain.j, s = top_state;
+    uint16_t from;
+    int8_t t;
+    if(top_digit == 0)
+        return;
+    term(i, j, top_digit);
+    /* Every chain starts from the empty chain of cell (0, 0) */
+    while(i > 0 || j > 0)
+    {
+        from = move(i, j, s);
+        (from & 32768) ? (j--): (i--);
+        s = (from >> 8) & 15;
+        t = (int8_t)(from & 255);
+        if(t != 0)
+            term(i, j, (int64_t)t);
+    }
+}
+
+#endif